@@ -29,6 +29,13 @@ void* array_hold(void* array, int count, int item_size) {
     }
 }
 
+// emptying the array but keeping its memory, so it can be refilled without reallocating
+void array_reset(void* array) {
+    if (array != NULL) {
+        ARRAY_OCCUPIED(array) = 0;
+    }
+}
+
 int array_length(void* array) {
     return (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
 }
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "headers/bench.h"
+
+// the whole report is one JSON object on stdout, so it can be piped straight into a tool;
+// anything human-readable goes to stderr
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of an already sorted array
+static double percentile(double* sorted, int count, double p) {
+    int rank = (int)ceil(p * count);
+    if(rank < 1) rank = 1;
+    if(rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+void bench_begin_report(char* obj_filename, int width, int height, int num_faces) {
+    printf("{\"asset\": \"%s\", \"width\": %d, \"height\": %d, \"faces\": %d, \"modes\": [\n",
+        obj_filename, width, height, num_faces);
+}
+
+void bench_report_result(bench_result_t* result, bool is_first) {
+    int count = result->num_frames;
+
+    double* sorted = (double*)malloc(sizeof(double) * count);
+    double total_ms = 0;
+    for(int i = 0; i < count; ++i) {
+        sorted[i] = result->frame_times[i];
+        total_ms += result->frame_times[i];
+    }
+    qsort(sorted, count, sizeof(double), compare_doubles);
+
+    double total_secs = total_ms / 1000.0;
+
+    printf("%s  {\"mode\": \"%s\", \"frames\": %d, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, "
+        "\"triangles_per_sec\": %.0f, \"pixels_per_sec\": %.0f}",
+        is_first ? "" : ",\n",
+        result->render_method,
+        count,
+        total_ms / count,
+        percentile(sorted, count, 0.50),
+        percentile(sorted, count, 0.99),
+        result->num_triangles / total_secs,
+        result->num_pixels / total_secs
+    );
+
+    // progress for whoever is watching the terminal
+    fprintf(stderr, "%-14s %8.3f ms/frame (p99 %.3f ms)\n",
+        result->render_method, total_ms / count, percentile(sorted, count, 0.99));
+
+    free(sorted);
+}
+
+void bench_end_report(void) {
+    printf("\n]}\n");
+    fflush(stdout);
+}
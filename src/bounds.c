@@ -0,0 +1,99 @@
+#include <math.h>
+#include <float.h>
+#include "headers/bounds.h"
+
+// a box that any union grows from; min > max, so it contains nothing
+aabb_t aabb_empty(void) {
+    aabb_t box = {
+        .min = { FLT_MAX, FLT_MAX, FLT_MAX },
+        .max = { -FLT_MAX, -FLT_MAX, -FLT_MAX }
+    };
+    return box;
+}
+
+bool aabb_is_empty(aabb_t box) {
+    return box.min.x > box.max.x;
+}
+
+aabb_t aabb_from_points(vec3_t* points, int count) {
+    aabb_t box = aabb_empty();
+    for(int i = 0; i < count; ++i){
+        box.min.x = fminf(box.min.x, points[i].x);
+        box.min.y = fminf(box.min.y, points[i].y);
+        box.min.z = fminf(box.min.z, points[i].z);
+        box.max.x = fmaxf(box.max.x, points[i].x);
+        box.max.y = fmaxf(box.max.y, points[i].y);
+        box.max.z = fmaxf(box.max.z, points[i].z);
+    }
+    return box;
+}
+
+aabb_t aabb_union(aabb_t a, aabb_t b) {
+    aabb_t box = {
+        .min = { fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y), fminf(a.min.z, b.min.z) },
+        .max = { fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y), fmaxf(a.max.z, b.max.z) }
+    };
+    return box;
+}
+
+// the box around the transformed box (Arvo's method): each row of the matrix moves the
+// center, and the absolute values of the row stretch the half extents
+aabb_t aabb_transform(aabb_t box, mat4_t m) {
+    if(aabb_is_empty(box)) return box;
+
+    float center[3] = { (box.min.x + box.max.x) * 0.5f, (box.min.y + box.max.y) * 0.5f, (box.min.z + box.max.z) * 0.5f };
+    float extent[3] = { (box.max.x - box.min.x) * 0.5f, (box.max.y - box.min.y) * 0.5f, (box.max.z - box.min.z) * 0.5f };
+
+    float new_center[3];
+    float new_extent[3];
+    for(int i = 0; i < 3; ++i){
+        new_center[i] = m.m[i][3];
+        new_extent[i] = 0;
+        for(int j = 0; j < 3; ++j){
+            new_center[i] += m.m[i][j] * center[j];
+            new_extent[i] += fabsf(m.m[i][j]) * extent[j];
+        }
+    }
+
+    aabb_t result = {
+        .min = { new_center[0] - new_extent[0], new_center[1] - new_extent[1], new_center[2] - new_extent[2] },
+        .max = { new_center[0] + new_extent[0], new_center[1] + new_extent[1], new_center[2] + new_extent[2] }
+    };
+    return result;
+}
+
+vec3_t aabb_center(aabb_t box) {
+    vec3_t center = { (box.min.x + box.max.x) * 0.5f, (box.min.y + box.max.y) * 0.5f, (box.min.z + box.max.z) * 0.5f };
+    return center;
+}
+
+// centered on the box, with the radius of the furthest point; not the smallest sphere,
+// but a tight one for the usual meshes and it only takes one pass
+bounding_sphere_t bounding_sphere_from_points(vec3_t* points, int count, aabb_t box) {
+    bounding_sphere_t sphere = { .center = aabb_center(box), .radius = 0 };
+
+    float radius_squared = 0;
+    for(int i = 0; i < count; ++i){
+        vec3_t d = vec3_sub(points[i], sphere.center);
+        radius_squared = fmaxf(radius_squared, vec3_dot(d, d));
+    }
+    sphere.radius = sqrtf(radius_squared);
+    return sphere;
+}
+
+// the radius grows with the largest scale of the matrix (the length of its longest axis)
+bounding_sphere_t bounding_sphere_transform(bounding_sphere_t sphere, mat4_t m) {
+    vec4_t center = mat4_mul_vec4(m, vec4_from_vec3(sphere.center));
+
+    float max_scale_squared = 0;
+    for(int j = 0; j < 3; ++j){
+        float axis_squared = m.m[0][j] * m.m[0][j] + m.m[1][j] * m.m[1][j] + m.m[2][j] * m.m[2][j];
+        max_scale_squared = fmaxf(max_scale_squared, axis_squared);
+    }
+
+    bounding_sphere_t result = {
+        .center = vec3_from_vec4(center),
+        .radius = sphere.radius * sqrtf(max_scale_squared)
+    };
+    return result;
+}
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include "headers/bvh.h"
+#include "headers/array.h"
+
+void bvh_init(bvh_t* bvh, int num_items) {
+    bvh->num_items = num_items;
+    bvh->num_nodes = 0;
+    // a binary tree with at least one item per leaf has at most 2n - 1 nodes
+    bvh->nodes = (bvh_node_t*)malloc(sizeof(bvh_node_t) * (num_items > 0 ? 2 * num_items - 1 : 1));
+    bvh->items = (int*)malloc(sizeof(int) * (num_items > 0 ? num_items : 1));
+    bvh->item_bounds = (aabb_t*)malloc(sizeof(aabb_t) * (num_items > 0 ? num_items : 1));
+    bvh->item_spheres = (bounding_sphere_t*)malloc(sizeof(bounding_sphere_t) * (num_items > 0 ? num_items : 1));
+}
+
+void bvh_set_item(bvh_t* bvh, int item, aabb_t bounds, bounding_sphere_t sphere) {
+    bvh->item_bounds[item] = bounds;
+    bvh->item_spheres[item] = sphere;
+}
+
+static float vec3_component(vec3_t v, int axis) {
+    return (axis == 0) ? v.x : (axis == 1) ? v.y : v.z;
+}
+
+// splitting items[first .. first + count - 1] in two at the middle of the longest axis of
+// their centers; falls back to halving the range when all the centers land on one side
+static void build_node(bvh_t* bvh, int node_index, int first, int count) {
+    bvh_node_t* node = &bvh->nodes[node_index];
+    node->first = first;
+    node->count = count;
+    node->left = -1;
+    node->bounds = aabb_empty();
+
+    aabb_t center_bounds = aabb_empty();
+    for(int i = first; i < first + count; ++i){
+        aabb_t item_bounds = bvh->item_bounds[bvh->items[i]];
+        vec3_t center = aabb_center(item_bounds);
+        node->bounds = aabb_union(node->bounds, item_bounds);
+        center_bounds = aabb_union(center_bounds, (aabb_t){ center, center });
+    }
+    if(count <= BVH_MAX_LEAF_SIZE) return;
+
+    vec3_t size = vec3_sub(center_bounds.max, center_bounds.min);
+    int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z) ? 1 : 2;
+    float split = vec3_component(aabb_center(center_bounds), axis);
+
+    int middle = first;
+    for(int i = first; i < first + count; ++i){
+        if(vec3_component(aabb_center(bvh->item_bounds[bvh->items[i]]), axis) < split){
+            int temp = bvh->items[i];
+            bvh->items[i] = bvh->items[middle];
+            bvh->items[middle] = temp;
+            ++middle;
+        }
+    }
+    if(middle == first || middle == first + count) middle = first + count / 2;
+
+    int left = bvh->num_nodes;
+    bvh->num_nodes += 2;
+    node->left = left;
+
+    build_node(bvh, left, first, middle - first);
+    build_node(bvh, left + 1, middle, first + count - middle);
+}
+
+// (re)building the tree from the current item bounds
+void bvh_build(bvh_t* bvh) {
+    for(int i = 0; i < bvh->num_items; ++i){
+        bvh->items[i] = i;
+    }
+    bvh->num_nodes = 0;
+    if(bvh->num_items == 0) return;
+
+    bvh->num_nodes = 1;
+    build_node(bvh, 0, 0, bvh->num_items);
+}
+
+// updating the node bounds after the items moved, keeping the shape of the tree; children
+// come after their parents, so walking the nodes backwards does it in one pass. the tree
+// gets looser the further the items move from where it was built
+void bvh_refit(bvh_t* bvh) {
+    for(int i = bvh->num_nodes - 1; i >= 0; --i){
+        bvh_node_t* node = &bvh->nodes[i];
+
+        if(node->left >= 0){
+            node->bounds = aabb_union(bvh->nodes[node->left].bounds, bvh->nodes[node->left + 1].bounds);
+            continue;
+        }
+        node->bounds = aabb_empty();
+        for(int j = node->first; j < node->first + node->count; ++j){
+            node->bounds = aabb_union(node->bounds, bvh->item_bounds[bvh->items[j]]);
+        }
+    }
+}
+
+static int* cull_node(bvh_t* bvh, int node_index, frustum_t* frustum, int* visible_items) {
+    bvh_node_t* node = &bvh->nodes[node_index];
+
+    enum frustum_test test = frustum_test_aabb(frustum, node->bounds);
+    if(test == FRUSTUM_OUTSIDE) return visible_items;
+
+    // everything under a node that's entirely inside is visible, without testing it
+    if(test == FRUSTUM_INSIDE){
+        for(int i = node->first; i < node->first + node->count; ++i){
+            array_push(visible_items, bvh->items[i]);
+        }
+        return visible_items;
+    }
+
+    if(node->left >= 0){
+        visible_items = cull_node(bvh, node->left, frustum, visible_items);
+        return cull_node(bvh, node->left + 1, frustum, visible_items);
+    }
+
+    // the sphere rejects cheaply; the box is tighter for long, thin items
+    for(int i = node->first; i < node->first + node->count; ++i){
+        int item = bvh->items[i];
+        if(frustum_test_sphere(frustum, bvh->item_spheres[item]) == FRUSTUM_OUTSIDE) continue;
+        if(frustum_test_aabb(frustum, bvh->item_bounds[item]) == FRUSTUM_OUTSIDE) continue;
+        array_push(visible_items, item);
+    }
+    return visible_items;
+}
+
+// the items whose bounds are at least partly inside the frustum, appended to the dynamic
+// array visible_items after resetting it; returns the array, array_push may have moved it
+int* bvh_cull(bvh_t* bvh, frustum_t* frustum, int* visible_items) {
+    array_reset(visible_items);
+    if(bvh->num_nodes > 0) visible_items = cull_node(bvh, 0, frustum, visible_items);
+    return visible_items;
+}
+
+void bvh_free(bvh_t* bvh) {
+    free(bvh->nodes);
+    free(bvh->items);
+    free(bvh->item_bounds);
+    free(bvh->item_spheres);
+    bvh->nodes = NULL;
+    bvh->items = NULL;
+    bvh->item_bounds = NULL;
+    bvh->item_spheres = NULL;
+    bvh->num_nodes = 0;
+    bvh->num_items = 0;
+}
@@ -0,0 +1,196 @@
+#include <math.h>
+#include "headers/clipping.h"
+
+static float screen_width = 0;
+static float screen_height = 0;
+
+// the guard band in normalized device coordinates: a vertex is inside it when
+// -guard_x * w <= x <= guard_x * w (and the same for y)
+static float guard_x = 1;
+static float guard_y = 1;
+
+void init_clipping(int width, int height) {
+    screen_width = width;
+    screen_height = height;
+    guard_x = 1 + GUARD_BAND_PIXELS / (width / 2.0);
+    guard_y = 1 + GUARD_BAND_PIXELS / (height / 2.0);
+}
+
+// the clip flags of a vertex, from the output of the vertex stage; the pixel coordinates
+// of vertices behind the near plane are meaningless (mirrored), so they only get CLIP_NEAR
+int vertex_clip_flags(vec4_t screen) {
+    // written so that a NaN w or z ends up behind the near plane
+    if(!(screen.w > 0 && screen.z >= 0)) return CLIP_NEAR;
+
+    int flags = 0;
+    if(screen.z > 1) flags |= CLIP_FAR;
+
+    if(screen.x < 0) flags |= OUTSIDE_LEFT;
+    if(screen.x > screen_width) flags |= OUTSIDE_RIGHT;
+    if(screen.y < 0) flags |= OUTSIDE_TOP;
+    if(screen.y > screen_height) flags |= OUTSIDE_BOTTOM;
+
+    if(screen.x < -GUARD_BAND_PIXELS) flags |= CLIP_GUARD_LEFT;
+    if(screen.x > screen_width + GUARD_BAND_PIXELS) flags |= CLIP_GUARD_RIGHT;
+    if(screen.y < -GUARD_BAND_PIXELS) flags |= CLIP_GUARD_TOP;
+    if(screen.y > screen_height + GUARD_BAND_PIXELS) flags |= CLIP_GUARD_BOTTOM;
+
+    return flags;
+}
+
+// the clip space positions are only computed here, for the few triangles that need clipping
+polygon_t polygon_from_triangle(
+    vec4_t world_a, vec4_t world_b, vec4_t world_c,
+    vec4_t screen_a, vec4_t screen_b, vec4_t screen_c,
+    tex2_t uv_a, tex2_t uv_b, tex2_t uv_c,
+    mat4_t* projection_matrix
+) {
+    polygon_t polygon = {
+        .vertices = {
+            { mat4_mul_vec4(*projection_matrix, world_a), screen_a, uv_a },
+            { mat4_mul_vec4(*projection_matrix, world_b), screen_b, uv_b },
+            { mat4_mul_vec4(*projection_matrix, world_c), screen_c, uv_c }
+        },
+        .num_vertices = 3
+    };
+    return polygon;
+}
+
+// signed distance of a clip space position to a plane, positive on the inside
+static float plane_distance(vec4_t p, int plane) {
+    switch(plane){
+        case CLIP_NEAR: return p.z;
+        case CLIP_FAR: return p.w - p.z;
+        case CLIP_GUARD_LEFT: return p.x + guard_x * p.w;
+        case CLIP_GUARD_RIGHT: return guard_x * p.w - p.x;
+        case CLIP_GUARD_TOP: return guard_y * p.w - p.y;    // the screen's y goes down
+        case CLIP_GUARD_BOTTOM: return p.y + guard_y * p.w;
+    }
+    return 0;
+}
+
+// the point where the edge from the inside vertex to the outside one crosses the plane;
+// always interpolated from the inside vertex, so the two triangles sharing an edge get the same point
+static polygon_vertex_t intersect(polygon_vertex_t* inside, polygon_vertex_t* outside, float d_inside, float d_outside) {
+    float t = d_inside / (d_inside - d_outside);
+
+    polygon_vertex_t vertex;
+    vertex.clip.x = inside->clip.x + t * (outside->clip.x - inside->clip.x);
+    vertex.clip.y = inside->clip.y + t * (outside->clip.y - inside->clip.y);
+    vertex.clip.z = inside->clip.z + t * (outside->clip.z - inside->clip.z);
+    vertex.clip.w = inside->clip.w + t * (outside->clip.w - inside->clip.w);
+    vertex.uv.u = inside->uv.u + t * (outside->uv.u - inside->uv.u);
+    vertex.uv.v = inside->uv.v + t * (outside->uv.v - inside->uv.v);
+
+    // perspective divide and viewport, like the vertex stage
+    float half_width = screen_width / 2.0;
+    float half_height = screen_height / 2.0;
+    vertex.screen.x = (vertex.clip.x / vertex.clip.w) * half_width + half_width;
+    vertex.screen.y = half_height - (vertex.clip.y / vertex.clip.w) * half_height;
+    vertex.screen.z = vertex.clip.z / vertex.clip.w;
+    vertex.screen.w = vertex.clip.w;
+
+    return vertex;
+}
+
+// Sutherland-Hodgman against one plane
+static void clip_polygon_against_plane(polygon_t* polygon, int plane) {
+    polygon_vertex_t inside_vertices[MAX_NUM_POLYGON_VERTICES];
+    int num_inside_vertices = 0;
+
+    polygon_vertex_t* previous = &polygon->vertices[polygon->num_vertices - 1];
+    float previous_distance = plane_distance(previous->clip, plane);
+
+    for(int i = 0; i < polygon->num_vertices; ++i){
+        polygon_vertex_t* current = &polygon->vertices[i];
+        float current_distance = plane_distance(current->clip, plane);
+
+        // the edge crosses the plane
+        if((current_distance >= 0) != (previous_distance >= 0)){
+            inside_vertices[num_inside_vertices++] = (current_distance >= 0)
+                ? intersect(current, previous, current_distance, previous_distance)
+                : intersect(previous, current, previous_distance, current_distance);
+        }
+        // the vertices inside are kept as they are (with their screen position from the vertex stage)
+        if(current_distance >= 0){
+            inside_vertices[num_inside_vertices++] = *current;
+        }
+
+        previous = current;
+        previous_distance = current_distance;
+    }
+
+    for(int i = 0; i < num_inside_vertices; ++i){
+        polygon->vertices[i] = inside_vertices[i];
+    }
+    polygon->num_vertices = num_inside_vertices;
+}
+
+// clipping against the planes (CLIP_* flags) that any vertex is outside of; a polygon that
+// ends up with less than 3 vertices is entirely outside
+void clip_polygon(polygon_t* polygon, int planes) {
+    static const int clip_planes[] = {
+        CLIP_NEAR, CLIP_FAR, CLIP_GUARD_LEFT, CLIP_GUARD_RIGHT, CLIP_GUARD_TOP, CLIP_GUARD_BOTTOM
+    };
+
+    // a vertex behind the near plane has no guard band flags, and the points the near plane
+    // cuts can be arbitrarily far off screen (w close to 0), so they always get the guard band too
+    if(planes & CLIP_NEAR){
+        planes |= CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_TOP | CLIP_GUARD_BOTTOM;
+    }
+
+    for(int i = 0; i < 6 && polygon->num_vertices >= 3; ++i){
+        if(planes & clip_planes[i]) clip_polygon_against_plane(polygon, clip_planes[i]);
+    }
+}
+
+// the planes of the clip volume (-w <= x <= w, -w <= y <= w, 0 <= z <= w) pulled back
+// through the matrix (Gribb & Hartmann); normalized so plane distances are in world units
+frustum_t frustum_from_matrix(mat4_t m) {
+    float planes[6][4];
+    for(int j = 0; j < 4; ++j){
+        planes[0][j] = m.m[3][j] + m.m[0][j];  // left
+        planes[1][j] = m.m[3][j] - m.m[0][j];  // right
+        planes[2][j] = m.m[3][j] + m.m[1][j];  // bottom
+        planes[3][j] = m.m[3][j] - m.m[1][j];  // top
+        planes[4][j] = m.m[2][j];              // near
+        planes[5][j] = m.m[3][j] - m.m[2][j];  // far
+    }
+
+    frustum_t frustum;
+    for(int i = 0; i < 6; ++i){
+        float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+        frustum.planes[i] = (vec4_t){ planes[i][0] / length, planes[i][1] / length, planes[i][2] / length, planes[i][3] / length };
+    }
+    return frustum;
+}
+
+enum frustum_test frustum_test_sphere(frustum_t* frustum, bounding_sphere_t sphere) {
+    enum frustum_test result = FRUSTUM_INSIDE;
+    for(int i = 0; i < 6; ++i){
+        vec4_t p = frustum->planes[i];
+        float distance = p.x * sphere.center.x + p.y * sphere.center.y + p.z * sphere.center.z + p.w;
+        if(distance < -sphere.radius) return FRUSTUM_OUTSIDE;
+        if(distance < sphere.radius) result = FRUSTUM_INTERSECTS;
+    }
+    return result;
+}
+
+// testing the box corner furthest along each plane's normal (the one most inside) and
+// the nearest one (most outside)
+enum frustum_test frustum_test_aabb(frustum_t* frustum, aabb_t box) {
+    enum frustum_test result = FRUSTUM_INSIDE;
+    for(int i = 0; i < 6; ++i){
+        vec4_t p = frustum->planes[i];
+        float far_x = (p.x >= 0) ? box.max.x : box.min.x;
+        float far_y = (p.y >= 0) ? box.max.y : box.min.y;
+        float far_z = (p.z >= 0) ? box.max.z : box.min.z;
+        if(p.x * far_x + p.y * far_y + p.z * far_z + p.w < 0) return FRUSTUM_OUTSIDE;
+
+        float near_x = (p.x >= 0) ? box.min.x : box.max.x;
+        float near_y = (p.y >= 0) ? box.min.y : box.max.y;
+        float near_z = (p.z >= 0) ? box.min.z : box.max.z;
+        if(p.x * near_x + p.y * near_y + p.z * near_z + p.w < 0) result = FRUSTUM_INTERSECTS;
+    }
+    return result;
+}
@@ -7,13 +7,22 @@ enum render_method render_method;
 int window_width = 800;
 int window_height = 600;
 
+bool is_headless = false;
+
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
 
 uint32_t* color_buffer = NULL;
 float* z_buffer = NULL;
+float* hiz_buffer = NULL;
+int hiz_width = 0;
+int hiz_height = 0;
 SDL_Texture* color_buffer_texture = NULL;
 
+// every draw_* function only touches pixels inside the clip rect of the calling thread,
+// so threads can draw into different tiles of the same buffers at the same time
+static __thread rect_t clip_rect = { 0, 0, 0, 0 };
+
 // USER-DEFINED FUNCTIONS
 // setting up the SDL environment
 bool initialize_window(void) {
@@ -72,49 +81,154 @@ bool initialize_window(void) {
     // to switch the window to fullscreen mode
     SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
 
+    set_clip_rect((rect_t){ 0, 0, window_width, window_height });
+
     return true;
 }
 
+// setting up an offscreen target; no SDL window, renderer or texture is created.
+// the color_buffer is the frame, and it can be read back from memory or saved to disk.
+bool initialize_headless(int width, int height){
+    if(width <= 0 || height <= 0){
+        fprintf(stderr, "Error: invalid headless resolution %dx%d \n", width, height);
+        return false;
+    }
+
+    window_width = width;
+    window_height = height;
+    is_headless = true;
+
+    set_clip_rect((rect_t){ 0, 0, window_width, window_height });
+
+    return true;
+}
+
+// the clip rect is per thread; initialize_window() sets the main thread's to the whole window
+void set_clip_rect(rect_t rect){
+    if(rect.x0 < 0) rect.x0 = 0;
+    if(rect.y0 < 0) rect.y0 = 0;
+    if(rect.x1 > window_width) rect.x1 = window_width;
+    if(rect.y1 > window_height) rect.y1 = window_height;
+    clip_rect = rect;
+}
+
+rect_t get_clip_rect(void){
+    return clip_rect;
+}
+
 void draw_grid(void){
-    for(int y = 0; y < window_height; y += 20){
-        for(int x = 0; x < window_width; x += 20){
+    draw_grid_rect(clip_rect);
+}
+
+void draw_grid_rect(rect_t rect){
+    // first multiples of 20 inside the rect
+    int first_x = ((rect.x0 + 19) / 20) * 20;
+    int first_y = ((rect.y0 + 19) / 20) * 20;
+
+    for(int y = first_y; y < rect.y1; y += 20){
+        for(int x = first_x; x < rect.x1; x += 20){
             color_buffer[(window_width * y) + x] = 0xFF333333;
         }
     }
 }
 
 void draw_pixel(int x, int y, uint32_t color){
-    if(x < 0 || y < 0 || x >= window_width || y >= window_height) return;
+    if(x < clip_rect.x0 || y < clip_rect.y0 || x >= clip_rect.x1 || y >= clip_rect.y1) return;
 
     color_buffer[(window_width * y) + x] = color;
 }
 
+// drawing a horizontal line from x0 to x1 (both included, in either order);
+// the same pixels as draw_line(x0, y, x1, y), but clipped once instead of per pixel
+void draw_span(int x0, int x1, int y, uint32_t color){
+    if(y < clip_rect.y0 || y >= clip_rect.y1) return;
+
+    if(x1 < x0){
+        int temp = x0;
+        x0 = x1;
+        x1 = temp;
+    }
+    if(x0 < clip_rect.x0) x0 = clip_rect.x0;
+    if(x1 > clip_rect.x1 - 1) x1 = clip_rect.x1 - 1;
+
+    uint32_t* row = &color_buffer[window_width * y];
+    for(int x = x0; x <= x1; ++x){
+        row[x] = color;
+    }
+}
+
+// drawing the pixels from (x, y) to (x + width, y + height), both included
 void draw_rect(int x, int y, int width, int height, uint32_t color){
-    for(int i = 0; i <= height; ++i){
-        for(int j = 0; j <= width; ++j){
-            int current_x = x + i;
-            int current_y = y + j;
-            draw_pixel(current_x, current_y, color);
-            // color_buffer[(window_width * (i + y)) + (j + x)] = color;
+    // clipped once, so the loops below write without any checks
+    int x0 = (x > clip_rect.x0) ? x : clip_rect.x0;
+    int y0 = (y > clip_rect.y0) ? y : clip_rect.y0;
+    int x1 = (x + width < clip_rect.x1 - 1) ? x + width : clip_rect.x1 - 1;
+    int y1 = (y + height < clip_rect.y1 - 1) ? y + height : clip_rect.y1 - 1;
+
+    for(int current_y = y0; current_y <= y1; ++current_y){
+        uint32_t* row = &color_buffer[window_width * current_y];
+        for(int current_x = x0; current_x <= x1; ++current_x){
+            row[current_x] = color;
         }
     }
 }
 
+// whether step i of a line lands inside the clip rect
+static inline bool line_step_is_inside(int x1, int y1, float x_inc, float y_inc, int i){
+    int current_x = roundf(x1 + i * x_inc);
+    int current_y = roundf(y1 + i * y_inc);
+    return current_x >= clip_rect.x0 && current_y >= clip_rect.y0 && current_x < clip_rect.x1 && current_y < clip_rect.y1;
+}
+
 void draw_line(int x1, int y1, int x2, int y2, uint32_t color){
     int delta_x = (x2 - x1);
     int delta_y = (y2 - y1);
 
     int longest_side_length = (abs(delta_x) >= abs(delta_y)) ? abs(delta_x) : abs(delta_y);
 
+    if(longest_side_length == 0){
+        draw_pixel(x1, y1, color);
+        return;
+    }
+
     float x_inc = delta_x / (float)longest_side_length;
     float y_inc = delta_y / (float)longest_side_length;
 
-    float current_x = x1;  
-    float current_y = y1;
-    for(int i = 0; i <= longest_side_length; ++i){
-        draw_pixel(round(current_x), round(current_y), color);
-        current_x += x_inc;
-        current_y += y_inc;
+    // only walking the steps that can land inside the clip rect (with half a pixel to spare);
+    // each point is computed from the start instead of accumulated, so a line clipped
+    // to different tiles lines up exactly
+    float first = 0;
+    float last = longest_side_length;
+    if(delta_x != 0){
+        float step_a = (clip_rect.x0 - 1 - x1) / x_inc;
+        float step_b = (clip_rect.x1 - x1) / x_inc;
+        first = fmaxf(first, fminf(step_a, step_b));
+        last = fminf(last, fmaxf(step_a, step_b));
+    } else if(x1 < clip_rect.x0 || x1 >= clip_rect.x1) return;
+    if(delta_y != 0){
+        float step_a = (clip_rect.y0 - 1 - y1) / y_inc;
+        float step_b = (clip_rect.y1 - y1) / y_inc;
+        first = fmaxf(first, fminf(step_a, step_b));
+        last = fminf(last, fmaxf(step_a, step_b));
+    } else if(y1 < clip_rect.y0 || y1 >= clip_rect.y1) return;
+    if(first > last) return;
+
+    int first_step = (int)first;
+    int last_step = (int)ceilf(last);
+
+    // the range above is off by at most a step or two at each end; x and y only move one
+    // way along the line, so the steps inside the clip rect are contiguous and trimming
+    // the ends leaves a loop that never has to check a pixel
+    while(first_step <= last_step && !line_step_is_inside(x1, y1, x_inc, y_inc, first_step)) ++first_step;
+    while(last_step >= first_step && !line_step_is_inside(x1, y1, x_inc, y_inc, last_step)) --last_step;
+
+    uint32_t* buffer = color_buffer;
+    int width = window_width;
+
+    for(int i = first_step; i <= last_step; ++i){
+        int current_x = roundf(x1 + i * x_inc);
+        int current_y = roundf(y1 + i * y_inc);
+        buffer[(width * current_y) + current_x] = color;
     }     
 }
 
@@ -126,6 +240,9 @@ void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t colo
 
 // updating the texture with the color_buffer data + rendering it to the screen.
 void render_color_buffer(void){
+    // in headless mode there's no screen to copy to; the frame stays in the color_buffer
+    if(is_headless) return;
+
     // this function updates the given texture with new pixel data. 
     SDL_UpdateTexture(
         color_buffer_texture, // the SDL_Texture that will be updated
@@ -159,10 +276,72 @@ void clear_z_buffer(void) {
             z_buffer[(window_width * y) + x] = 1.0;
         }
     }
+    for(int i = 0; i < hiz_width * hiz_height; ++i){
+        hiz_buffer[i] = 1.0;
+    }
+}
+
+// clearing just one tile, so a thread can clear the part of the buffers it's about to draw
+void clear_color_buffer_rect(rect_t rect, uint32_t color){
+    for(int y = rect.y0; y < rect.y1; ++y){
+        // a row pointer, so the compiler doesn't reload the globals after every store
+        uint32_t* row = &color_buffer[window_width * y];
+        for(int x = rect.x0; x < rect.x1; ++x){
+            row[x] = color;
+        }
+    }
+}
+
+// the hiz_buffer blocks the rect touches are reset too; tiles are made of whole blocks,
+// so threads clearing different tiles never share one
+void clear_z_buffer_rect(rect_t rect){
+    for(int y = rect.y0; y < rect.y1; ++y){
+        float* row = &z_buffer[window_width * y];
+        for(int x = rect.x0; x < rect.x1; ++x){
+            row[x] = 1.0;
+        }
+    }
+    for(int hiz_y = rect.y0 / HIZ_BLOCK_SIZE; hiz_y <= (rect.y1 - 1) / HIZ_BLOCK_SIZE; ++hiz_y){
+        for(int hiz_x = rect.x0 / HIZ_BLOCK_SIZE; hiz_x <= (rect.x1 - 1) / HIZ_BLOCK_SIZE; ++hiz_x){
+            hiz_buffer[(hiz_width * hiz_y) + hiz_x] = 1.0;
+        }
+    }
+}
+
+// writing the color_buffer to disk as a binary PPM (P6) image
+bool save_color_buffer(char* filename){
+    FILE* file = fopen(filename, "wb");
+
+    if(!file){
+        fprintf(stderr, "Error: Could not open the file %s \n", filename);
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", window_width, window_height);
+
+    // the buffer is SDL_PIXELFORMAT_RGBA32, so the bytes are R, G, B, A in memory;
+    // PPM has no alpha channel, so it is dropped row by row
+    uint8_t* row = (uint8_t*)malloc(window_width * 3);
+    for(int y = 0; y < window_height; ++y){
+        for(int x = 0; x < window_width; ++x){
+            uint32_t color = color_buffer[(window_width * y) + x];
+            row[(x * 3) + 0] = (color >> 0) & 0xFF;
+            row[(x * 3) + 1] = (color >> 8) & 0xFF;
+            row[(x * 3) + 2] = (color >> 16) & 0xFF;
+        }
+        fwrite(row, 3, window_width, file);
+    }
+    free(row);
+
+    fclose(file);
+    return true;
 }
 
 // cleanup function
 void destroy_window(void){
+    // nothing was created through SDL in headless mode
+    if(is_headless) return;
+
     // destroy the SDL_Renderer
     SDL_DestroyRenderer(renderer);
     // destroy the SDL_Window
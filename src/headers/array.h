@@ -8,6 +8,7 @@
     } while (0);
 
 void* array_hold(void* array, int count, int item_size);
+void array_reset(void* array);
 int array_length(void* array);
 void array_free(void* array);
 
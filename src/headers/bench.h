@@ -0,0 +1,19 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+
+// frame timings collected for one render method
+typedef struct {
+    char* render_method;    // name as accepted by --mode
+    int num_frames;
+    double* frame_times;    // milliseconds, one per frame
+    long long num_triangles; // triangles rasterized over all the frames
+    long long num_pixels;    // window_width * window_height * num_frames
+} bench_result_t;
+
+void bench_begin_report(char* obj_filename, int width, int height, int num_faces);
+void bench_report_result(bench_result_t* result, bool is_first);
+void bench_end_report(void);
+
+#endif
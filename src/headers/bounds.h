@@ -0,0 +1,29 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+
+// axis aligned bounding box
+typedef struct {
+    vec3_t min;
+    vec3_t max;
+} aabb_t;
+
+typedef struct {
+    vec3_t center;
+    float radius;
+} bounding_sphere_t;
+
+aabb_t aabb_empty(void);
+bool aabb_is_empty(aabb_t box);
+aabb_t aabb_from_points(vec3_t* points, int count);
+aabb_t aabb_union(aabb_t a, aabb_t b);
+aabb_t aabb_transform(aabb_t box, mat4_t m);
+vec3_t aabb_center(aabb_t box);
+
+bounding_sphere_t bounding_sphere_from_points(vec3_t* points, int count, aabb_t box);
+bounding_sphere_t bounding_sphere_transform(bounding_sphere_t sphere, mat4_t m);
+
+#endif
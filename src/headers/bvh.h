@@ -0,0 +1,35 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "bounds.h"
+#include "clipping.h"
+
+// leaves hold up to this many items
+#define BVH_MAX_LEAF_SIZE 4
+
+typedef struct {
+    aabb_t bounds;
+    int left;   // index of the left child (the right one is left + 1); -1 for leaves
+    int first;  // the items under the node are items[first .. first + count - 1]
+    int count;
+} bvh_node_t;
+
+// bounding volume hierarchy over a fixed set of items (e.g. the meshes of the scene),
+// built once and refit when the items move
+typedef struct {
+    bvh_node_t* nodes;              // nodes[0] is the root; parents come before their children
+    int num_nodes;
+    int* items;                     // item indices, grouped by node
+    aabb_t* item_bounds;            // indexed by item, set with bvh_set_item()
+    bounding_sphere_t* item_spheres;
+    int num_items;
+} bvh_t;
+
+void bvh_init(bvh_t* bvh, int num_items);
+void bvh_set_item(bvh_t* bvh, int item, aabb_t bounds, bounding_sphere_t sphere);
+void bvh_build(bvh_t* bvh);
+void bvh_refit(bvh_t* bvh);
+int* bvh_cull(bvh_t* bvh, frustum_t* frustum, int* visible_items);
+void bvh_free(bvh_t* bvh);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CLIPPING_H
+#define CLIPPING_H
+
+#include "vector.h"
+#include "matrix.h"
+#include "texture.h"
+#include "bounds.h"
+
+// triangles are clipped in homogeneous (clip) space, before the perspective divide, against
+// the near and far planes and against a guard band GUARD_BAND_PIXELS outside the screen.
+// the rasterizer clamps to the screen itself, so the x/y planes only need clipping when a
+// vertex is so far out that its pixel coordinates would overflow the rasterizer
+#define GUARD_BAND_PIXELS 8192
+
+// the rasterizer rejects vertices further than this (in pixels) from the top-left corner; it
+// keeps the edge values inside an 8x8 block within an int32, and the guard band keeps every
+// clipped vertex well inside it
+#define MAX_VERTEX_COORD 32768.0f
+
+// a triangle with its 3 vertices clipped by the 6 planes has at most 9
+#define MAX_NUM_POLYGON_VERTICES 10
+
+// what a vertex is outside of; the CLIP_* planes are clipped against, the OUTSIDE_*
+// screen edges are only used to drop triangles that are entirely off screen
+enum clip_flags {
+    CLIP_NEAR = 1 << 0,
+    CLIP_FAR = 1 << 1,
+    CLIP_GUARD_LEFT = 1 << 2,
+    CLIP_GUARD_RIGHT = 1 << 3,
+    CLIP_GUARD_TOP = 1 << 4,
+    CLIP_GUARD_BOTTOM = 1 << 5,
+    OUTSIDE_LEFT = 1 << 6,
+    OUTSIDE_RIGHT = 1 << 7,
+    OUTSIDE_TOP = 1 << 8,
+    OUTSIDE_BOTTOM = 1 << 9
+};
+#define CLIP_PLANES (CLIP_NEAR | CLIP_FAR | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_TOP | CLIP_GUARD_BOTTOM)
+
+typedef struct {
+    vec4_t clip;    // position in clip space, before the perspective divide
+    vec4_t screen;  // x and y in pixels, z after the perspective divide, w before it
+    tex2_t uv;
+} polygon_vertex_t;
+
+typedef struct {
+    polygon_vertex_t vertices[MAX_NUM_POLYGON_VERTICES];
+    int num_vertices;
+} polygon_t;
+
+// the view frustum as 6 planes (a, b, c, d) with a*x + b*y + c*z + d >= 0 on the inside,
+// in the space the matrix it was extracted from takes its input in
+typedef struct {
+    vec4_t planes[6];
+} frustum_t;
+
+enum frustum_test {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECTS,
+    FRUSTUM_INSIDE
+};
+
+void init_clipping(int width, int height);
+frustum_t frustum_from_matrix(mat4_t m);
+enum frustum_test frustum_test_sphere(frustum_t* frustum, bounding_sphere_t sphere);
+enum frustum_test frustum_test_aabb(frustum_t* frustum, aabb_t box);
+int vertex_clip_flags(vec4_t screen);
+polygon_t polygon_from_triangle(
+    vec4_t world_a, vec4_t world_b, vec4_t world_c,
+    vec4_t screen_a, vec4_t screen_b, vec4_t screen_c,
+    tex2_t uv_a, tex2_t uv_b, tex2_t uv_c,
+    mat4_t* projection_matrix
+);
+void clip_polygon(polygon_t* polygon, int planes);
+
+#endif
@@ -8,11 +8,23 @@
 #define FPS 30
 #define FRAME_TARGET_TIME (1000 / FPS) // how long should 1 frame take (in mili-secs)
 
+// hiz_buffer keeps one value per HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE block of pixels: the
+// largest z_buffer value in it, so a triangle behind it can skip the whole block
+#define HIZ_BLOCK_SIZE 8
+
 enum cull_method {
     CULL_NONE,
     CULL_BACKFACE
 };
 
+// a rectangle of pixels, [x0, x1) by [y0, y1)
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} rect_t;
+
 enum render_method {
     RENDER_WIRE,
     RENDER_WIRE_VERTEX,
@@ -33,15 +45,26 @@ extern SDL_Renderer* renderer;
 
 extern uint32_t* color_buffer;
 extern float* z_buffer;
+extern float* hiz_buffer;
+extern int hiz_width;
+extern int hiz_height;
 extern SDL_Texture* color_buffer_texture;
 
 extern int window_width;
 extern int window_height;
 
+// true when rendering offscreen (no SDL window); see initialize_headless()
+extern bool is_headless;
+
 // FUNCTION SIGNATURES
 bool initialize_window(void);
+bool initialize_headless(int width, int height);
+
+void set_clip_rect(rect_t rect);
+rect_t get_clip_rect(void);
 
 void draw_pixel(int x, int y, uint32_t color);
+void draw_span(int x0, int x1, int y, uint32_t color);
 void draw_grid(void);
 void draw_rect(int x, int y, int width, int height, uint32_t color);
 void draw_line(int x1, int y1, int x2, int y2, uint32_t color);
@@ -50,6 +73,10 @@ void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t colo
 void render_color_buffer(void);
 void clear_color_buffer(uint32_t color);
 void clear_z_buffer(void);
+void clear_color_buffer_rect(rect_t rect, uint32_t color);
+void clear_z_buffer_rect(rect_t rect);
+void draw_grid_rect(rect_t rect);
+bool save_color_buffer(char* filename);
 
 void destroy_window(void);
 
@@ -1,8 +1,17 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "vector.h"
+#include "matrix.h"
 #include "triangle.h"
+#include "texture.h"
+#include "bounds.h"
+#include "meshlet.h"
+
+// the full detail mesh and up to this many - 1 simplified versions of it
+#define MESH_MAX_LODS 6
 
 #define N_CUBE_VERTICES 8
 #define N_CUBE_FACES (6 * 2)
@@ -10,17 +19,45 @@
 extern vec3_t cube_vertices[N_CUBE_VERTICES];
 extern face_t mesh_faces[N_CUBE_FACES];
 
+// a level of detail: a range of the meshlets of the mesh, and how far its surface strays
+// from the full detail one (0 for level 0), in object space
+typedef struct {
+    int first_meshlet;
+    int num_meshlets;
+    int num_faces;
+    float error;
+} mesh_lod_t;
+
 typedef struct {
     vec3_t* vertices;   // dynamic array of vertices
+    tex2_t* uvs;        //   "       "   of texture coordinates, one per vertex
     face_t* faces;      //   "       "   of faces
+    meshlet_t* meshlets; //  "       "   of meshlets; the faces and vertices are in meshlet order
+    mesh_lod_t lods[MESH_MAX_LODS]; // each level's meshlets follow the ones of the level before
+    int num_lods;
+    int lod;            // the level drawn last frame; meshes pick their own, instances too
+    vec3_soa_t positions; // SoA copy of the vertices for the SIMD vertex stage; x is NULL when absent
+    texture_t* texture;
+    aabb_t bounds;                      // object space bounds of the vertices, computed at load
+    bounding_sphere_t bounding_sphere;
+    bool is_instance;   // shares the vertices, faces and texture of another mesh, which owns them
+    void* mapping;      // the mesh cache the arrays point into when loaded from one; NULL otherwise
+    size_t mapping_size;
     vec3_t rotation;    // rotation with x, y, and z values
     vec3_t scale;       // scale with x, y, and z values
     vec3_t translation; // translation with x, y, and z values
+    mat4_t world_matrix; // from the three above; rebuilt every frame
 } mesh_t;
 
-extern mesh_t mesh;
+void load_cube_mesh_data(mesh_t* mesh);
+void load_obj_file_data(mesh_t* mesh, char* filename, bool reorder);
+void build_meshlets(mesh_t* mesh);
 
-void load_cube_mesh_data(void);
-void load_obj_file_data(char* filename);
+// the scene: every mesh that gets rendered
+int load_mesh(char* obj_filename, char* png_filename, bool use_cache, bool reorder, vec3_t scale, vec3_t translation, vec3_t rotation);
+int add_mesh_instance(int mesh_index, vec3_t scale, vec3_t translation, vec3_t rotation);
+int get_num_meshes(void);
+mesh_t* get_mesh(int mesh_index);
+void free_meshes(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,22 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <stdbool.h>
+#include "mesh.h"
+
+// a mesh cache is the loaded mesh (vertices, uvs, faces, meshlets, levels of detail, SoA
+// positions and bounds) written as the in-memory arrays themselves, so loading it is one
+// mmap with no parsing (or simplifying). it's written next to the .obj on its first load
+// and only used while the .obj keeps the size and modification time it had then. the
+// format is whatever this build lays the structs out as, so MESH_CACHE_VERSION has to go
+// up whenever the mesh data changes
+#define MESH_CACHE_MAGIC 0x4853454D // "MESH"
+#define MESH_CACHE_VERSION 4
+#define MESH_CACHE_EXTENSION ".cache"
+
+// is_reordered is whether the mesh was (or has to have been) reordered for locality
+bool load_mesh_cache(mesh_t* mesh, char* obj_filename, bool is_reordered);
+bool save_mesh_cache(mesh_t* mesh, char* obj_filename, bool is_reordered);
+void unmap_mesh_cache(mesh_t* mesh);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+#include "bounds.h"
+#include "clipping.h"
+
+// limits of one cluster of faces; small enough for the bounds to be tight, big enough
+// for the per-cluster tests to be cheap next to the faces they skip
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_FACES 124
+
+// a face only joins a cluster when its normal is within about 45 degrees of the
+// cluster's average normal, so the normal cones stay narrow enough to cull with
+#define MESHLET_MIN_NORMAL_DOT 0.7
+
+// a cluster of neighbouring faces; its faces are mesh.faces[first_face ..] and, since
+// the vertices on the border between clusters are duplicated, its vertices are
+// mesh.vertices[first_vertex ..] too
+typedef struct {
+    int first_face;
+    int num_faces;
+    int first_vertex;
+    int num_vertices;
+    bounding_sphere_t bounding_sphere; // object space, around the vertices
+    // every face normal is within the cone around cone_axis with the half angle
+    // whose cosine/sine these are; has_cone is false when the cone is too wide to cull with
+    bool has_cone;
+    vec3_t cone_axis;
+    float cone_cos;
+    float cone_sin;
+} meshlet_t;
+
+bool meshlet_is_visible(meshlet_t* meshlet, mat4_t world_matrix, bool cull_backfaces, frustum_t* frustum, vec3_t camera);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "triangle.h"
+
+// parsing the v, vt and f lines of an .obj into dynamic arrays of vertices, their texture
+// coordinates, and faces indexing both; a vertex is a distinct (v, vt) pair of the file.
+// the rest of the file is ignored
+bool load_obj_file(char* filename, vec3_t** vertices, tex2_t** uvs, face_t** faces);
+
+#endif
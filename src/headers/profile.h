@@ -0,0 +1,70 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "timer.h"
+
+// the stages of a frame, in the order update() and render() run them
+enum profile_stage {
+    PROFILE_TEXTURE_RESIDENCY,  // evicting and reloading mip levels to stay within --texture-budget
+    PROFILE_FRUSTUM_CULL,       // moving the meshes, refitting the scene BVH and culling it
+    PROFILE_MESHLET_CULL,       // frustum and normal cone tests of the meshlets of the visible meshes
+    PROFILE_VERTEX_TRANSFORM,   // world transform + projection of every vertex
+    PROFILE_BACKFACE_CULL,
+    PROFILE_CLIPPING,           // near/far and guard band clipping of the triangles that cross them
+    PROFILE_TRIANGLE_ASSEMBLY,  // lighting + pushing into the per-thread bins
+    PROFILE_MERGE_BINS,         // concatenating the bins into triangles_to_render
+    PROFILE_SORT,
+    PROFILE_BIN_TRIANGLES,      // sorting the triangles into screen tiles
+    PROFILE_CLEAR_COLOR_BUFFER, // the clears, grid and rasterization run per tile, on the thread pool
+    PROFILE_CLEAR_Z_BUFFER,
+    PROFILE_DRAW_GRID,
+    PROFILE_RASTER_VERTICES,    // one rasterization stage per render method
+    PROFILE_RASTER_FILL,
+    PROFILE_RASTER_TEXTURED,
+    PROFILE_RASTER_WIRE,
+    PROFILE_RENDER_COLOR_BUFFER,
+    NUM_PROFILE_STAGES
+};
+
+typedef struct {
+    int frame;
+    uint64_t total_ns;
+    uint64_t stage_ns[NUM_PROFILE_STAGES];
+} profile_frame_t;
+
+// GLOBAL VARIABLES
+// when false every profile_* call below is a single predictable branch
+extern bool profile_enabled;
+extern profile_frame_t profile_current_frame;
+
+// FUNCTION SIGNATURES
+void profile_init(int history_size);
+void profile_begin_frame(int frame);
+void profile_end_frame(void);
+bool profile_dump_csv(char* filename);
+void profile_free(void);
+
+// returns the start time of a stage; pair with profile_stop()
+static inline uint64_t profile_start(void) {
+    return profile_enabled ? timer_now_ns() : 0;
+}
+
+// adding the time since `start` to a stage; a stage may be started and stopped
+// many times per frame (e.g. once per triangle) and accumulates
+static inline void profile_stop(enum profile_stage stage, uint64_t start) {
+    if(profile_enabled) profile_current_frame.stage_ns[stage] += timer_now_ns() - start;
+}
+
+// for stages that run on the thread pool: time is accumulated locally with profile_elapsed()
+// and added once per job with profile_add(), so such stages sum the time of all threads
+static inline uint64_t profile_elapsed(uint64_t start) {
+    return profile_enabled ? timer_now_ns() - start : 0;
+}
+
+static inline void profile_add(enum profile_stage stage, uint64_t elapsed_ns) {
+    if(profile_enabled) __sync_fetch_and_add(&profile_current_frame.stage_ns[stage], elapsed_ns);
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdbool.h>
+#include "triangle.h"
+
+// the screen is rasterized in square tiles of TILE_SIZE pixels; each tile's part of
+// the color_buffer and z_buffer (64x64x8 bytes = 32KB) stays in the L1/L2 cache of
+// the thread drawing it
+#define TILE_SIZE 64
+
+void raster_init(void);
+bool raster_needs_painter_order(void);
+void rasterize_triangles(triangle_t* triangles, int num_of_triangles);
+void raster_free(void);
+
+#endif
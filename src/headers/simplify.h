@@ -0,0 +1,27 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "vector.h"
+#include "triangle.h"
+
+// every level has at most this fraction of the faces of the one before it
+#define SIMPLIFY_LEVEL_RATIO 0.5
+// a level has to drop at least this fraction of the faces of the one before it to be kept
+#define SIMPLIFY_MIN_REDUCTION 0.15
+// no level gets simplified further once it's down to this many faces
+#define SIMPLIFY_MIN_FACES 64
+
+// a simplified version of a mesh: a dynamic array of faces indexing (a subset of) the
+// vertices of the original, and how far its surface strays from the original's, in the
+// units of the vertices (the square root of the worst quadric error of its collapses)
+typedef struct {
+    face_t* faces;
+    float error;
+} simplified_level_t;
+
+// simplifying a mesh into a chain of up to max_levels ever coarser levels by quadric error
+// edge collapses; returns how many levels there are. the vertices of uv seams and open
+// borders stay where they are, so the texture and the outline keep their shape
+int simplify_mesh(vec3_t* vertices, int num_vertices, face_t* faces, int num_faces, simplified_level_t* levels, int max_levels);
+
+#endif
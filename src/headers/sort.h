@@ -3,8 +3,8 @@
 
 #include "triangle.h"
 
-void quick_sort(triangle_t triangles_to_render[], int low, int high);
-int partition(triangle_t triangles_to_render[], int low, int high);
+// sorting the triangles from back to front by their average depth (stable)
 void sort_triangles(triangle_t triangles_to_render[], int num_of_triangles);
+void sort_free(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,20 +1,86 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
-#include "upng.h"
+
+// enough levels for a 32768x32768 texture
+#define TEXTURE_MAX_LEVELS 16
+// the checkerboard used for meshes without a (readable) png
+#define DEFAULT_TEXTURE_SIZE 64
+#define DEFAULT_TEXTURE_SQUARE_SIZE 8
 
 typedef struct {
     float u;
     float v;
 } tex2_t;
 
-extern int texture_width;
-extern int texture_height;
+// the texels are stored in tiles of 4x4 (64 bytes, a cache line), the texels of a tile
+// row by row and the tiles themselves row by row, so the texels next to each other in
+// either direction are mostly in the same cache line. the last row and column of tiles
+// are padded when the size isn't a multiple of 4
+typedef struct {
+    uint32_t* texels;    // NULL while the level isn't resident
+    int width;
+    int height;
+    int tile_row_stride; // texels per row of tiles
+    int last_used;       // the last frame the level was sampled in (see update_texture_residency())
+} texture_level_t;
+
+// a texture and its mip chain: level 0 is the full texture, and every level after it is
+// half the size of the one before (rounded down), down to 1x1. the finest levels can be
+// evicted to stay within the texture budget, so only [first_level, num_levels) are
+// resident; a texture nobody references can lose all of them
+typedef struct {
+    texture_level_t levels[TEXTURE_MAX_LEVELS];
+    int num_levels;
+    int first_level;
+    uint32_t used_levels; // a bit per level the rasterizer wanted since the last update_texture_residency()
+    char* filename;       // the png it's decoded (again) from; NULL for the default texture
+    bool can_reload;      // false once decoding the png failed
+    bool is_streaming;    // its png is being decoded on the streaming thread
+    bool use_cache;       // its coarse levels are read from (and written to) the texture cache
+    int references;       // meshes using it
+    size_t bytes;         // of its resident levels
+} texture_t;
+
+// where texel (x, y) of a level is stored
+static inline int texel_offset(const texture_level_t* level, int x, int y) {
+    return (y >> 2) * level->tile_row_stride + ((x >> 2) << 4) + ((y & 3) << 2) + (x & 3);
+}
+
+static inline size_t get_texture_level_bytes(const texture_level_t* level) {
+    return (size_t)((level->height + 3) / 4) * level->tile_row_stride * sizeof(uint32_t);
+}
+
+// called by the rasterizer threads for the level they'd like to sample; the bit is only
+// written (atomically) the first time in a frame
+static inline void mark_texture_level_used(texture_t* texture, int level) {
+    uint32_t bit = 1u << level;
+    if(!(__atomic_load_n(&texture->used_levels, __ATOMIC_RELAXED) & bit)){
+        __atomic_fetch_or(&texture->used_levels, bit, __ATOMIC_RELAXED);
+    }
+}
 
-extern upng_t* png_texture;
-extern uint32_t* mesh_texture;
+// the texture of a png, loaded once and shared by everyone who acquires the same
+// filename; the default texture when the png can't be read. it's usable right away, but
+// only with its coarse levels from the texture cache (use_cache), or a single gray texel
+// without one, until the streaming thread has decoded the png and update_texture_residency()
+// has swapped the levels in. every acquire_texture() is paired with a release_texture()
+texture_t* acquire_texture(char* filename, bool use_cache);
+void release_texture(texture_t* texture);
+// waiting for every png being decoded and swapping their levels in
+void finish_texture_streaming(void);
 
-void load_png_texture_data(char* filename);
+// how many bytes of texels may stay resident; 0 for no limit
+void set_texture_budget(size_t bytes);
+size_t get_texture_bytes(void);
+// once per frame, outside of rendering: swapping in the levels the streaming thread has
+// decoded, having it decode the levels the rasterizer wanted that were evicted when they
+// fit in the budget, and evicting the least recently used levels (the finest first) and
+// unreferenced textures until the resident ones fit again
+void update_texture_residency(void);
+void free_textures(void);
 
-#endif
\ No newline at end of file
+#endif
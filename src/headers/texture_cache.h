@@ -0,0 +1,24 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <stdbool.h>
+#include "texture.h"
+
+// a texture cache holds the coarse mip levels of a png (the ones no bigger than
+// TEXTURE_CACHE_LEVEL_SIZE on either side), tiled as they are in memory, so a texture has
+// something to show before its png is decoded. it's written next to the png after its
+// first decode and only used while the png keeps the size and modification time it had
+// then; TEXTURE_CACHE_VERSION has to go up whenever the texel layout changes
+#define TEXTURE_CACHE_MAGIC 0x52545854 // "TXTR"
+#define TEXTURE_CACHE_VERSION 1
+#define TEXTURE_CACHE_EXTENSION ".cache"
+#define TEXTURE_CACHE_LEVEL_SIZE 64
+
+// making the cached levels of a texture resident; the levels have to be set up for the
+// size of the png and none of them resident. false (with the texture untouched) when
+// there's no cache or it doesn't match the png anymore
+bool load_texture_cache(texture_t* texture, char* png_filename);
+// writing the coarse levels out of a full mip chain
+bool save_texture_cache(const texture_level_t* levels, int num_levels, char* png_filename);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// a job is called once for every index in [0, count); `thread` is which thread of the
+// pool runs it (0 is the thread that called thread_pool_run()), e.g. to pick a per-thread buffer
+typedef void (*thread_job_t)(void* context, int index, int thread);
+
+// num_threads counts the calling thread too; 0 uses one thread per online CPU
+void thread_pool_init(int num_threads);
+int thread_pool_size(void);
+// runs the jobs on every thread of the pool and returns once all of them are done
+void thread_pool_run(thread_job_t job, void* context, int count);
+void thread_pool_free(void);
+
+#endif
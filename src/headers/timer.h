@@ -0,0 +1,10 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// high-resolution monotonic clock; unlike SDL_GetTicks() it works without SDL_Init()
+uint64_t timer_now_ns(void);
+double timer_now_ms(void);
+
+#endif
@@ -5,13 +5,11 @@
 #include "texture.h"
 #include "vector.h"
 
+// the corners index the vertices of the mesh, and their uvs with them
 typedef struct {
     int a;
     int b;
     int c;
-    tex2_t a_uv;
-    tex2_t b_uv;
-    tex2_t c_uv;
     uint32_t color;
 } face_t;
 
@@ -20,20 +18,21 @@ typedef struct {
     tex2_t tex_coords[3];
     uint32_t color;
     float avg_depth;
+    texture_t* texture; // the texture of the mesh the triangle belongs to
 } triangle_t;
 
 void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
-void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
-void draw_texel(
-    int x, int y, uint32_t* texture,
-    vec4_t point_a, vec4_t point_b, vec4_t point_c,
-    tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+void draw_filled_triangle(
+    float x0, float y0, float w0,
+    float x1, float y1, float w1,
+    float x2, float y2, float w2,
+    uint32_t color
 );
 void draw_textured_triangle(
-    int x0, int y0, float z0, float w0, float u0, float v0, 
-    int x1, int y1, float z1, float w1, float u1, float v1, 
-    int x2, int y2, float z2, float w2, float u2, float v2,
-    uint32_t* texture
+    float x0, float y0, float w0, float u0, float v0, 
+    float x1, float y1, float w1, float u1, float v1, 
+    float x2, float y2, float w2, float u2, float v2,
+    texture_t* texture
 );
 
 #endif
\ No newline at end of file
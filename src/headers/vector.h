@@ -20,6 +20,14 @@ typedef struct {
     float w;
 } vec4_t;
 
+// structure-of-arrays storage for many vec3_t; x[i], y[i] and z[i] form the i-th vector.
+// lets SIMD code load the same component of several vectors with one instruction
+typedef struct {
+    float* x;
+    float* y;
+    float* z;
+} vec3_soa_t;
+
 // VECTOR 2D functions
 float vec2_length(vec2_t v);
 vec2_t vec2_add(vec2_t a, vec2_t b);
@@ -49,4 +57,8 @@ vec4_t vec4_from_vec3(vec3_t v);
 vec3_t vec3_from_vec4(vec4_t v);
 vec2_t vec2_from_vec4(vec4_t v);
 
+// VECTOR SoA functions
+vec3_soa_t vec3_soa_from_array(vec3_t* vectors, int count);
+void vec3_soa_free(vec3_soa_t* soa);
+
 #endif
\ No newline at end of file
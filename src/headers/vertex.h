@@ -0,0 +1,25 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+#include "vector.h"
+#include "matrix.h"
+
+// output of the vertex stage for one mesh vertex
+typedef struct {
+    vec4_t world;   // after the world matrix; used for culling, lighting and depth sorting
+    vec4_t screen;  // x and y in pixels, z after the perspective divide, w before it
+} transformed_vertex_t;
+
+mat4_t make_world_matrix(vec3_t scale, vec3_t rotation, vec3_t translation);
+void transform_vertices(
+    vec3_t* vertices, int num_vertices,
+    mat4_t world_matrix, mat4_t projection_matrix,
+    transformed_vertex_t* transformed_vertices
+);
+void transform_vertices_soa(
+    vec3_soa_t* positions, int num_vertices,
+    mat4_t world_matrix, mat4_t projection_matrix,
+    transformed_vertex_t* transformed_vertices
+);
+
+#endif
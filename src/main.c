@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <SDL2/SDL.h>
 
 #include "headers/upng.h"
@@ -13,34 +15,284 @@
 #include "headers/light.h"
 #include "headers/triangle.h"
 #include "headers/texture.h"
+#include "headers/timer.h"
+#include "headers/bench.h"
+#include "headers/profile.h"
+#include "headers/vertex.h"
+#include "headers/thread_pool.h"
+#include "headers/raster.h"
+#include "headers/clipping.h"
+#include "headers/bounds.h"
+#include "headers/bvh.h"
+#include "headers/mesh_cache.h"
+#include "headers/texture_cache.h"
+
+// command line options; see print_usage() for the flags
+typedef struct {
+    bool headless;
+    bool bench;             // time every render method and print a JSON report (implies headless)
+    int width;              // headless resolution; the window always uses the display mode
+    int height;
+    int frames;             // number of frames to render; 0 runs until the window is closed
+    enum render_method render_method;
+    char* obj_filename;
+    char* png_filename;
+    char* output_filename;  // printf-style pattern (e.g. "frame_%04d.ppm"); NULL keeps frames in memory
+    char* profile_filename; // CSV with per-stage timings; NULL disables the profiler
+    int profile_frames;     // how many of the most recent frames the profiler keeps
+    int threads;            // size of the thread pool, including the main thread; 0 = one per CPU
+    int instances;          // copies of the mesh in the scene, laid out in a grid
+    bool use_mesh_cache;    // load meshes (and placeholder textures) from the binary caches next to their files
+    bool reorder_meshes;    // reorder the faces and vertices of the meshes for locality at load
+    float lod_error;        // largest error in pixels a level of detail may show; 0 draws full detail
+    float texture_budget;   // megabytes of texels that may stay resident; 0 for no limit
+    bool stream_textures;   // render before the pngs are decoded; headless runs wait for them otherwise
+} options_t;
 
 // GLOBAL VARIABLES
 bool is_running = false;
 int previous_frame_time = 0;
+int frame_index = 0;
+int num_triangles_rendered = 0;
+
+options_t options = {
+    .headless = false,
+    .bench = false,
+    .width = 800,
+    .height = 600,
+    .frames = 0,
+    .render_method = RENDER_WIRE,
+    .obj_filename = "./assets/f22.obj",
+    .png_filename = "./assets/f22.png",
+    .output_filename = NULL,
+    .profile_filename = NULL,
+    .profile_frames = 300,
+    .threads = 0,
+    .instances = 1,
+    .use_mesh_cache = true,
+    .reorder_meshes = true,
+    .lod_error = 1.0,
+    .texture_budget = 0,
+    .stream_textures = false
+};
 
 triangle_t* triangles_to_render = NULL;
 
+// scratch space for the vertex stage; grows to fit the mesh and is reused every frame
+transformed_vertex_t* transformed_vertices = NULL;
+int transformed_vertices_capacity = 0;
+
+// per-thread output of the face stage (one dynamic array per chunk of faces),
+// kept between frames so they don't have to grow again
+triangle_t** triangle_bins = NULL;
+
 vec3_t camera_view = {0, 0, 0};
 mat4_t projection_matrix;
 
+// the camera sits at the origin, so the planes of the projection are in world space
+frustum_t view_frustum;
+// hierarchy over the bounds of every mesh in the scene, and the meshes it finds in view
+bvh_t scene_bvh;
+int* visible_meshes = NULL;
+// the meshlets of the current mesh that survive the meshlet culling
+int* visible_meshlets = NULL;
+
 // USER-DEFINED FUNCTIONS
+void print_usage(char* program){
+    printf("usage: %s [options]\n", program);
+    printf("  --headless            render offscreen, without opening an SDL window\n");
+    printf("  --resolution WxH      headless resolution (default 800x600)\n");
+    printf("  --frames N            stop after N frames (default: 1 when headless, unlimited otherwise)\n");
+    printf("  --mode MODE           wire-vertex, wire, fill, fill-wire, textured, textured-wire (or 1-6)\n");
+    printf("  --obj FILE            mesh to load (default ./assets/f22.obj)\n");
+    printf("  --png FILE            texture to load (default: the .obj path with a .png extension)\n");
+    printf("  --output PATTERN      save every frame as a PPM, e.g. frame_%%04d.ppm\n");
+    printf("  --bench               time N frames (--frames, default 100) of every render mode, print JSON\n");
+    printf("  --profile FILE        time every stage of the last frames, write them as CSV on exit (or 'p')\n");
+    printf("  --profile-frames N    how many frames the profiler keeps (default 300)\n");
+    printf("  --threads N           worker threads, including the main one (default: one per CPU)\n");
+    printf("  --instances N         render N copies of the mesh, laid out in a grid (default 1)\n");
+    printf("  --no-mesh-cache       always parse the .obj, without reading or writing FILE.obj%s (or FILE.png%s)\n", MESH_CACHE_EXTENSION, TEXTURE_CACHE_EXTENSION);
+    printf("  --no-reorder          keep the faces and vertices in the order of the .obj\n");
+    printf("  --lod-error PIXELS    largest error a simplified level of a mesh may show (default 1, 0 = full detail)\n");
+    printf("  --texture-budget MB   memory the textures may keep resident, evicting unused mip levels (default 0, no limit)\n");
+    printf("  --stream-textures     render headless frames before the textures are decoded, like the window does\n");
+}
+
+// names accepted by --mode, indexed by enum render_method;
+// the numbers match the keyboard shortcuts in process_input()
+char* render_method_names[][2] = {
+    [RENDER_WIRE] = { "wire", "2" },
+    [RENDER_WIRE_VERTEX] = { "wire-vertex", "1" },
+    [RENDER_FILL_TRIANGLE] = { "fill", "3" },
+    [RENDER_FILL_TRIANGLE_WIRE] = { "fill-wire", "4" },
+    [RENDER_TEXTURED] = { "textured", "5" },
+    [RENDER_TEXTURED_WIRE] = { "textured-wire", "6" },
+};
+
+bool parse_render_method(char* name, enum render_method* method){
+    for(int i = RENDER_WIRE; i <= RENDER_TEXTURED_WIRE; ++i){
+        if(strcmp(name, render_method_names[i][0]) == 0 || strcmp(name, render_method_names[i][1]) == 0){
+            *method = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_arguments(int argc, char* argv[]){
+    static char png_filename[1024];
+    bool has_png = false;
+    bool has_frames = false;
+
+    for(int i = 1; i < argc; ++i){
+        char* arg = argv[i];
+        // every option except --headless, --bench, --no-mesh-cache, --no-reorder, --stream-textures and --help takes a value
+        char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(strcmp(arg, "--headless") == 0){
+            options.headless = true;
+            continue;
+        }
+        if(strcmp(arg, "--bench") == 0){
+            options.bench = true;
+            options.headless = true;
+            continue;
+        }
+        if(strcmp(arg, "--no-mesh-cache") == 0){
+            options.use_mesh_cache = false;
+            continue;
+        }
+        if(strcmp(arg, "--no-reorder") == 0){
+            options.reorder_meshes = false;
+            continue;
+        }
+        if(strcmp(arg, "--stream-textures") == 0){
+            options.stream_textures = true;
+            continue;
+        }
+        if(strcmp(arg, "--help") == 0) return false;
+
+        if(value == NULL){
+            fprintf(stderr, "Error: unknown option or missing value for %s\n", arg);
+            return false;
+        }
+        ++i;
+
+        if(strcmp(arg, "--resolution") == 0){
+            if(sscanf(value, "%dx%d", &options.width, &options.height) != 2){
+                fprintf(stderr, "Error: invalid resolution %s\n", value);
+                return false;
+            }
+        } else if(strcmp(arg, "--frames") == 0){
+            options.frames = atoi(value);
+            has_frames = true;
+        } else if(strcmp(arg, "--mode") == 0){
+            if(!parse_render_method(value, &options.render_method)){
+                fprintf(stderr, "Error: unknown render mode %s\n", value);
+                return false;
+            }
+        } else if(strcmp(arg, "--obj") == 0){
+            options.obj_filename = value;
+        } else if(strcmp(arg, "--png") == 0){
+            options.png_filename = value;
+            has_png = true;
+        } else if(strcmp(arg, "--output") == 0){
+            options.output_filename = value;
+        } else if(strcmp(arg, "--profile") == 0){
+            options.profile_filename = value;
+        } else if(strcmp(arg, "--profile-frames") == 0){
+            options.profile_frames = atoi(value);
+        } else if(strcmp(arg, "--threads") == 0){
+            options.threads = atoi(value);
+        } else if(strcmp(arg, "--lod-error") == 0){
+            options.lod_error = atof(value);
+        } else if(strcmp(arg, "--texture-budget") == 0){
+            options.texture_budget = atof(value);
+        } else if(strcmp(arg, "--instances") == 0){
+            options.instances = atoi(value);
+            if(options.instances < 1){
+                fprintf(stderr, "Error: invalid number of instances %s\n", value);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "Error: unknown option %s\n", arg);
+            return false;
+        }
+    }
+
+    // the bundled assets ship the texture next to the mesh, with the same name
+    if(!has_png){
+        snprintf(png_filename, sizeof(png_filename), "%s", options.obj_filename);
+        char* extension = strrchr(png_filename, '.');
+        if(extension != NULL && strlen(extension) == 4) strcpy(extension, ".png");
+        options.png_filename = png_filename;
+    }
+
+    // a headless run has no window to close, so it must end on its own (0 frames, unlimited
+    // with a window, would never end), and the benchmark report needs frames to average over
+    if(options.headless && !has_frames) options.frames = options.bench ? 100 : 1;
+    if(options.headless && options.frames < 1){
+        fprintf(stderr, "Error: %s needs at least 1 frame, got %d\n", options.bench ? "--bench" : "--headless", options.frames);
+        return false;
+    }
+
+    return true;
+}
+
+// the mesh from the command line, and as many copies of it as --instances asks for on a
+// square grid going away from the camera; the first one is where a single mesh always was
+void setup_scene(void){
+    vec3_t scale = { 1.0, 1.0, 1.0 };
+    vec3_t rotation = { 0, 0, 0 };
+    vec3_t translation = { 0, 0, 5.0 };
+    int mesh_index = load_mesh(options.obj_filename, options.png_filename, options.use_mesh_cache, options.reorder_meshes, scale, translation, rotation);
+
+    int grid_size = 1;
+    while(grid_size * grid_size < options.instances) ++grid_size;
+    float spacing = 2.5 * get_mesh(mesh_index)->bounding_sphere.radius;
+
+    for(int i = 1; i < options.instances; ++i){
+        // the columns alternate around the middle one: 0, 1, -1, 2, -2, ...
+        int column = i % grid_size;
+        int offset = (column % 2 == 1) ? (column + 1) / 2 : -(column / 2);
+        translation.x = offset * spacing;
+        translation.z = 5.0 + (i / grid_size) * spacing;
+        add_mesh_instance(mesh_index, scale, translation, rotation);
+    }
+
+    // the tree is built around where the meshes start; update() refits it as they move
+    bvh_init(&scene_bvh, get_num_meshes());
+    for(int i = 0; i < get_num_meshes(); ++i){
+        mesh_t* mesh = get_mesh(i);
+        mesh->world_matrix = make_world_matrix(mesh->scale, mesh->rotation, mesh->translation);
+        bvh_set_item(&scene_bvh, i, aabb_transform(mesh->bounds, mesh->world_matrix), bounding_sphere_transform(mesh->bounding_sphere, mesh->world_matrix));
+    }
+    bvh_build(&scene_bvh);
+}
+
 void setup(void){
     // initialising render mode and triangle culling method
-    render_method = RENDER_WIRE;
+    render_method = options.render_method;
     cull_method = CULL_BACKFACE; 
 
     // allocating the memory (in bytes) to hold the color_buffer
     color_buffer = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
     z_buffer = (float*)malloc(sizeof(float) * window_width * window_height);
+    hiz_width = (window_width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    hiz_height = (window_height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    hiz_buffer = (float*)malloc(sizeof(float) * hiz_width * hiz_height);
 
     // creating the SDL_Texture that is used to display the color_buffer
-    color_buffer_texture = SDL_CreateTexture(
-        renderer,
-        SDL_PIXELFORMAT_RGBA32,
-        SDL_TEXTUREACCESS_STREAMING,
-        window_width,
-        window_height
-    );
+    if(!is_headless){
+        color_buffer_texture = SDL_CreateTexture(
+            renderer,
+            SDL_PIXELFORMAT_RGBA32,
+            SDL_TEXTUREACCESS_STREAMING,
+            window_width,
+            window_height
+        );
+    }
 
     float fov = 3.141592 / 3.0; // (PI / 3)
     float aspect = (float)window_height / (float)window_width;
@@ -49,14 +301,30 @@ void setup(void){
 
     // initialising the perspective projection matrix
     projection_matrix = mat4_make_perspective(fov, aspect, znear, zfar);
+    init_clipping(window_width, window_height);
+    view_frustum = frustum_from_matrix(projection_matrix);
+
+    // the pool comes first, the .obj files are parsed on it
+    thread_pool_init(options.threads);
+
+    set_texture_budget((size_t)(options.texture_budget * 1024 * 1024));
+    setup_scene();
+
+    // the window shows the textures as their pngs get decoded; saved and benchmarked frames
+    // have to be the same every run
+    if(options.headless && !options.stream_textures) finish_texture_streaming();
 
-    // load_cube_mesh_data();
-    load_obj_file_data("./assets/f22.obj");
-    load_png_texture_data("./assets/f22.png");
+    if(options.profile_filename != NULL) profile_init(options.profile_frames);
+
+    triangle_bins = (triangle_t**)calloc(thread_pool_size(), sizeof(triangle_t*));
+    raster_init();
 }
 
 // for input validation and processing
 void process_input(void){
+    // there's no window (and no event queue) in headless mode
+    if(is_headless) return;
+
     // datatype of SDL_Event stores the information about an event.
     // e.g. keypress, mouse movement, window close, etc. 
     SDL_Event event;
@@ -98,247 +366,481 @@ void process_input(void){
             
             if(event.key.keysym.sym == SDLK_d)
                 cull_method = CULL_NONE;
+
+            if(event.key.keysym.sym == SDLK_p && options.profile_filename != NULL)
+                profile_dump_csv(options.profile_filename);
             
             break;
     }
 }
 
-void update(void){
-    int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
-    if(time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) SDL_Delay(time_to_wait);
+// the vertex stage runs in chunks of about this many vertices
+#define VERTEX_CHUNK_SIZE 4096
+// meshes with fewer faces than this per thread don't get split across every thread
+#define MIN_FACE_CHUNK_SIZE 1024
+
+// what the vertex and face stage jobs of a mesh share; both stages only see the
+// meshlets that passed the culling
+typedef struct {
+    mesh_t* mesh;
+    mat4_t world_matrix;
+    int* meshlets;
+    int num_of_meshlets;
+    int num_of_vertex_chunks;
+    int num_of_face_chunks;
+} frame_context_t;
+
+// the visible meshlets [first, last) that one chunk of a stage works on
+void get_chunk_meshlets(frame_context_t* frame, int chunk, int num_of_chunks, int* first, int* last){
+    *first = (int)((long long)frame->num_of_meshlets * chunk / num_of_chunks);
+    *last = (int)((long long)frame->num_of_meshlets * (chunk + 1) / num_of_chunks);
+}
 
-    previous_frame_time = SDL_GetTicks();
+void transform_vertex_chunk(void* context, int chunk, int thread){
+    frame_context_t* frame = (frame_context_t*)context;
+    mesh_t* mesh = frame->mesh;
 
-    triangles_to_render = NULL;
+    int first_meshlet, last_meshlet;
+    get_chunk_meshlets(frame, chunk, frame->num_of_vertex_chunks, &first_meshlet, &last_meshlet);
 
-    // mesh.rotation.x += 0.01;
-    mesh.rotation.y += 0.01;
-    // mesh.rotation.z += 0.005;
+    // each meshlet's vertices are a range of the mesh's, transformed in place
+    for(int m = first_meshlet; m < last_meshlet; ++m){
+        meshlet_t* meshlet = &mesh->meshlets[frame->meshlets[m]];
+        int first = meshlet->first_vertex;
+        int count = meshlet->num_vertices;
 
-    // mesh.translation.x += 0.01;
-    // mesh.translation.y += 0.01;
-    mesh.translation.z = 5.0;
+        if(mesh->positions.x != NULL){
+            vec3_soa_t positions = { &mesh->positions.x[first], &mesh->positions.y[first], &mesh->positions.z[first] };
+            transform_vertices_soa(&positions, count, frame->world_matrix, projection_matrix, &transformed_vertices[first]);
+        } else {
+            transform_vertices(&mesh->vertices[first], count, frame->world_matrix, projection_matrix, &transformed_vertices[first]);
+        }
+    }
+}
 
-    mat4_t scale_matrix = mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
-    mat4_t translation_matrix = mat4_make_translation(
-                                    mesh.translation.x, 
-                                    mesh.translation.y, 
-                                    mesh.translation.z
-                                );
-    mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh.rotation.x);
-    mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh.rotation.y);
-    mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh.rotation.z);
+// culling, lighting and assembling the triangles of one range of meshlets into its own bin;
+// bins are only ever touched by the thread running their chunk, so no locking is needed
+void process_face_chunk(void* context, int chunk, int thread){
+    frame_context_t* frame = (frame_context_t*)context;
 
-    int num_of_faces = array_length(mesh.faces);
+    int first_meshlet, last_meshlet;
+    get_chunk_meshlets(frame, chunk, frame->num_of_face_chunks, &first_meshlet, &last_meshlet);
 
-    for(int i = 0; i < num_of_faces; ++i){
-        face_t mesh_face = mesh.faces[i];
+    triangle_t* bin = triangle_bins[chunk];
+    array_reset(bin);
 
-        vec3_t face_vertices[3];
-        face_vertices[0] = mesh.vertices[mesh_face.a];
-        face_vertices[1] = mesh.vertices[mesh_face.b];
-        face_vertices[2] = mesh.vertices[mesh_face.c];
+    uint64_t cull_ns = 0;
+    uint64_t clip_ns = 0;
+    uint64_t assembly_ns = 0;
 
-        vec4_t transformed_vertices[3];
+    // face stage: gathering the transformed vertices of each face by index
+    for(int m = first_meshlet; m < last_meshlet; ++m){
+        meshlet_t* meshlet = &frame->mesh->meshlets[frame->meshlets[m]];
 
-        for(int j = 0; j < 3; ++j){
-            vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
+        for(int i = meshlet->first_face; i < meshlet->first_face + meshlet->num_faces; ++i){
+            uint64_t stage_start = profile_start();
 
-            // creating a world matrix combining scale, rotation, and translation matrices.
-            mat4_t world_matrix = mat4_identity();
-            
-            //////// ORDER of transformation /////////
-            // first SCALE
-            // then ROTATE
-            // lastly TRANSLATE
+            face_t mesh_face = frame->mesh->faces[i];
 
-            world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-            
-            world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
+            transformed_vertex_t* vertex_a = &transformed_vertices[mesh_face.a];
+            transformed_vertex_t* vertex_b = &transformed_vertices[mesh_face.b];
+            transformed_vertex_t* vertex_c = &transformed_vertices[mesh_face.c];
 
-            world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+            vec3_t vector_A = vec3_from_vec4(vertex_a->world);
+            vec3_t vector_B = vec3_from_vec4(vertex_b->world);
+            vec3_t vector_C = vec3_from_vec4(vertex_c->world);
 
-            transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
+            vec3_t vector_AB = vec3_sub(vector_B, vector_A);
+            vec3_t vector_AC = vec3_sub(vector_C, vector_A);
 
-            // saving the transformed vertex in the array of transformed_vertices
-            transformed_vertices[j] = transformed_vertex;
-        }
-        
-        vec3_t vector_A = vec3_from_vec4(transformed_vertices[0]);
-        vec3_t vector_B = vec3_from_vec4(transformed_vertices[1]);
-        vec3_t vector_C = vec3_from_vec4(transformed_vertices[2]);
-
-        vec3_t vector_AB = vec3_sub(vector_B, vector_A);
-        vec3_t vector_AC = vec3_sub(vector_C, vector_A);
-        vec3_normalise(&vector_AB);        
-        vec3_normalise(&vector_AC);        
-        
-        vec3_t vector_normal = vec3_cross(vector_AB, vector_AC);
-        vec3_normalise(&vector_normal);        
+            // only the sign matters for culling, so the normal is normalised after it (for the lighting)
+            vec3_t vector_normal = vec3_cross(vector_AB, vector_AC);
 
-        vec3_t camera_ray = vec3_sub(camera_view, vector_A);
+            vec3_t camera_ray = vec3_sub(camera_view, vector_A);
 
-        float dot_normal_camera = vec3_dot(vector_normal, camera_ray);
+            float dot_normal_camera = vec3_dot(vector_normal, camera_ray);
 
-        if(cull_method == CULL_BACKFACE){
-            if(dot_normal_camera < 0){
+            if(cull_method == CULL_BACKFACE){
+                if(dot_normal_camera < 0){
+                    cull_ns += profile_elapsed(stage_start);
+                    continue;
+                }
+            }
+            vec3_normalise(&vector_normal);
+
+            // trivial reject: all three vertices outside the same plane or screen edge
+            int flags_a = vertex_clip_flags(vertex_a->screen);
+            int flags_b = vertex_clip_flags(vertex_b->screen);
+            int flags_c = vertex_clip_flags(vertex_c->screen);
+            if(flags_a & flags_b & flags_c){
+                cull_ns += profile_elapsed(stage_start);
                 continue;
             }
+
+            cull_ns += profile_elapsed(stage_start);
+            stage_start = profile_start();
+        
+            // calucating the average depth for each face based on the 
+            // vertices after transformation
+            float avg_depth = (vector_A.z + vector_B.z + vector_C.z) / 3.0; 
+
+            float light_intensity_factor = -1 * vec3_dot(vector_normal, light.direction);
+
+            // calculating the triangle color based on the light angle
+            uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
+
+            // the uvs are only looked up for the faces that made it past culling
+            tex2_t uv_a = frame->mesh->uvs[mesh_face.a];
+            tex2_t uv_b = frame->mesh->uvs[mesh_face.b];
+            tex2_t uv_c = frame->mesh->uvs[mesh_face.c];
+
+            // the common case: nothing to clip, the vertex stage output is used as is
+            int clip_planes = (flags_a | flags_b | flags_c) & CLIP_PLANES;
+            if(clip_planes == 0){
+                triangle_t projected_triangle = {
+                    .points = { vertex_a->screen, vertex_b->screen, vertex_c->screen },
+                    .tex_coords = { uv_a, uv_b, uv_c },
+                    .color = triangle_color,
+                    .avg_depth = avg_depth,
+                    .texture = frame->mesh->texture
+                };
+                array_push(bin, projected_triangle);
+
+                assembly_ns += profile_elapsed(stage_start);
+                continue;
+            }
+
+            assembly_ns += profile_elapsed(stage_start);
+            stage_start = profile_start();
+
+            polygon_t polygon = polygon_from_triangle(
+                vertex_a->world, vertex_b->world, vertex_c->world,
+                vertex_a->screen, vertex_b->screen, vertex_c->screen,
+                uv_a, uv_b, uv_c,
+                &projection_matrix
+            );
+            clip_polygon(&polygon, clip_planes);
+
+            // triangulating the clipped polygon as a fan around its first vertex
+            for(int j = 1; j + 1 < polygon.num_vertices; ++j){
+                polygon_vertex_t* fan[3] = { &polygon.vertices[0], &polygon.vertices[j], &polygon.vertices[j + 1] };
+
+                triangle_t clipped_triangle = {
+                    .points = { fan[0]->screen, fan[1]->screen, fan[2]->screen },
+                    .tex_coords = { fan[0]->uv, fan[1]->uv, fan[2]->uv },
+                    .color = triangle_color,
+                    .avg_depth = avg_depth,
+                    .texture = frame->mesh->texture
+                };
+                array_push(bin, clipped_triangle);
+            }
+
+            clip_ns += profile_elapsed(stage_start);
         }
+    }
 
+    // array_push may have moved the bin
+    triangle_bins[chunk] = bin;
 
-        vec4_t projected_points[3];
+    profile_add(PROFILE_BACKFACE_CULL, cull_ns);
+    profile_add(PROFILE_CLIPPING, clip_ns);
+    profile_add(PROFILE_TRIANGLE_ASSEMBLY, assembly_ns);
+}
 
-        // projection loop for the 3 vertices
-        for(int j = 0; j < 3; ++j){
-            projected_points[j] = mat4_mul_vec4_project(projection_matrix, transformed_vertices[j]);
+// a mesh only goes back to a finer level once the error of its level is this much past
+// --lod-error, so a mesh sitting right at a switching distance doesn't flicker between two
+#define LOD_HYSTERESIS 0.25
 
-            // scaling into the view
-            projected_points[j].x *= (window_width / 2.0);
-            projected_points[j].y *= (window_height / 2.0);
+// how many pixels an error of one unit in the mesh's object space covers on screen, at
+// the nearest point of its bounding sphere
+float get_mesh_pixels_per_unit(mesh_t* mesh){
+    bounding_sphere_t sphere = bounding_sphere_transform(mesh->bounding_sphere, mesh->world_matrix);
+    float scale = (mesh->bounding_sphere.radius > 0) ? sphere.radius / mesh->bounding_sphere.radius : 1;
 
-            // inverting the Y values to account for flipped screen Y coordinate
-            projected_points[j].y *= -1;
+    // the camera looks down +z from the origin, so the depth is the world z
+    float distance = sphere.center.z - sphere.radius;
+    if(!(distance > 0)) return INFINITY;
 
-            // translating the projected_points to the middle of the screen
-            projected_points[j].x += (window_width / 2.0);
-            projected_points[j].y += (window_height / 2.0);
-        }
-        
-        // calucating the average depth for each face based on the 
-        // vertices after transformation
-        float avg_depth = (transformed_vertices[0].z + transformed_vertices[1].z + transformed_vertices[2].z) / 3.0; 
-
-        float light_intensity_factor = -1 * vec3_dot(vector_normal, light.direction);
-
-        // calculating the triangle color based on the light angle
-        uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
-
-        triangle_t projected_triangle = {
-            .points = {
-                { projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
-                { projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w },
-                { projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w },
-            },
-            .tex_coords = {
-                { mesh_face.a_uv.u, mesh_face.a_uv.v },
-                { mesh_face.b_uv.u, mesh_face.b_uv.v },
-                { mesh_face.c_uv.u, mesh_face.c_uv.v },
-            },
-            .color = triangle_color,
-            .avg_depth = avg_depth 
-        };
-        array_push(triangles_to_render, projected_triangle);
+    return scale * projection_matrix.m[1][1] * (window_height / 2.0) / distance;
+}
+
+// picking the coarsest level of detail whose error stays under --lod-error pixels
+void select_mesh_lod(mesh_t* mesh){
+    if(options.lod_error <= 0){
+        mesh->lod = 0;
+        return;
     }
 
-    // sorting the triangles to render by their average depth
-    int num_of_triangles = array_length(triangles_to_render);
-    sort_triangles(triangles_to_render, num_of_triangles);
+    float pixels_per_unit = get_mesh_pixels_per_unit(mesh);
+    int lod = (mesh->lod < mesh->num_lods) ? mesh->lod : mesh->num_lods - 1;
+    if(lod < 0) lod = 0;
+    while(lod > 0 && mesh->lods[lod].error * pixels_per_unit > options.lod_error * (1 + LOD_HYSTERESIS)) --lod;
+    while(lod + 1 < mesh->num_lods && mesh->lods[lod + 1].error * pixels_per_unit <= options.lod_error) ++lod;
+    mesh->lod = lod;
 }
 
-// handling the rendering process
-void render(void){
-    SDL_RenderClear(renderer);
+// the meshlet culling, vertex and face stages of one mesh, appending its triangles to triangles_to_render
+void process_mesh(mesh_t* mesh){
+    // a mesh whose .obj failed to load has no levels of detail, and nothing to draw
+    if(mesh->num_lods == 0) return;
+
+    // meshlet culling: whole meshlets of the level of detail in use outside the frustum, or
+    // facing away from the camera, are dropped before any of their vertices are transformed
+    uint64_t stage_start = profile_start();
+
+    // the normal cones are only valid when the world matrix keeps the angles between
+    // directions (and their sides), i.e. for uniform positive scales
+    bool cull_backfaces = cull_method == CULL_BACKFACE &&
+        mesh->scale.x > 0 && mesh->scale.x == mesh->scale.y && mesh->scale.x == mesh->scale.z;
+
+    select_mesh_lod(mesh);
+    mesh_lod_t* lod = &mesh->lods[mesh->lod];
+
+    int num_of_visible_vertices = 0;
+    int num_of_visible_faces = 0;
+    array_reset(visible_meshlets);
+    for(int i = lod->first_meshlet; i < lod->first_meshlet + lod->num_meshlets; ++i){
+        meshlet_t* meshlet = &mesh->meshlets[i];
+        if(!meshlet_is_visible(meshlet, mesh->world_matrix, cull_backfaces, &view_frustum, camera_view)) continue;
+
+        array_push(visible_meshlets, i);
+        num_of_visible_vertices += meshlet->num_vertices;
+        num_of_visible_faces += meshlet->num_faces;
+    }
 
-    draw_grid();
+    profile_stop(PROFILE_MESHLET_CULL, stage_start);
 
-    int num_of_triangles = array_length(triangles_to_render);
-    for(int i = 0; i < num_of_triangles; ++i){
-        triangle_t triangle = triangles_to_render[i];
+    frame_context_t frame = {
+        .mesh = mesh,
+        .world_matrix = mesh->world_matrix,
+        .meshlets = visible_meshlets,
+        .num_of_meshlets = array_length(visible_meshlets)
+    };
+    if(frame.num_of_meshlets == 0) return;
 
-        if(render_method == RENDER_WIRE_VERTEX){
-            // drawing vectex points
-            draw_rect(triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6, 0xFFFF00FF);
-            draw_rect(triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6, 0xFFFF00FF);
-            draw_rect(triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6, 0xFFFF00FF);
-        }
+    // vertex stage: transforming and projecting every vertex of the visible meshlets once
+    stage_start = profile_start();
 
-        if(render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE){
-            // drawing filled triangle
-            draw_filled_triangle(
-                triangle.points[0].x, 
-                triangle.points[0].y,
-                triangle.points[1].x,
-                triangle.points[1].y,
-                triangle.points[2].x,
-                triangle.points[2].y,
-                triangle.color
-            );
-        }
+    int num_of_vertices = array_length(mesh->vertices);
+    if(num_of_vertices > transformed_vertices_capacity){
+        transformed_vertices = (transformed_vertex_t*)realloc(transformed_vertices, sizeof(transformed_vertex_t) * num_of_vertices);
+        transformed_vertices_capacity = num_of_vertices;
+    }
+    frame.num_of_vertex_chunks = (num_of_visible_vertices + VERTEX_CHUNK_SIZE - 1) / VERTEX_CHUNK_SIZE;
+    if(frame.num_of_vertex_chunks > frame.num_of_meshlets) frame.num_of_vertex_chunks = frame.num_of_meshlets;
+    thread_pool_run(transform_vertex_chunk, &frame, frame.num_of_vertex_chunks);
 
-        if(render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE){
-            // drawing textured triangle
-            draw_textured_triangle(
-                triangle.points[0].x, 
-                triangle.points[0].y,
-                triangle.points[0].z,
-                triangle.points[0].w,
-                triangle.tex_coords[0].u,
-                triangle.tex_coords[0].v,
-                triangle.points[1].x,
-                triangle.points[1].y,
-                triangle.points[1].z,
-                triangle.points[1].w,
-                triangle.tex_coords[1].u,
-                triangle.tex_coords[1].v,
-                triangle.points[2].x,
-                triangle.points[2].y,
-                triangle.points[2].z,
-                triangle.points[2].w,
-                triangle.tex_coords[2].u,
-                triangle.tex_coords[2].v,
-                mesh_texture
-            );
-        }
+    profile_stop(PROFILE_VERTEX_TRANSFORM, stage_start);
 
-        if(render_method == RENDER_WIRE || render_method == RENDER_WIRE_VERTEX || render_method == RENDER_FILL_TRIANGLE_WIRE || render_method == RENDER_TEXTURED_WIRE){
-            // drawing triangle lines
-            draw_triangle(
-                triangle.points[0].x, 
-                triangle.points[0].y,
-                triangle.points[1].x,
-                triangle.points[1].y,
-                triangle.points[2].x,
-                triangle.points[2].y,
-                0xFFFFFFFF
-            );
-        }
+    // face stage: one contiguous range of meshlets per bin, at most one bin per thread
+    frame.num_of_face_chunks = (num_of_visible_faces + MIN_FACE_CHUNK_SIZE - 1) / MIN_FACE_CHUNK_SIZE;
+    if(frame.num_of_face_chunks > thread_pool_size()) frame.num_of_face_chunks = thread_pool_size();
+    if(frame.num_of_face_chunks > frame.num_of_meshlets) frame.num_of_face_chunks = frame.num_of_meshlets;
+    thread_pool_run(process_face_chunk, &frame, frame.num_of_face_chunks);
+
+    // concatenating the bins in face order, so the result matches a serial face loop
+    stage_start = profile_start();
+
+    for(int i = 0; i < frame.num_of_face_chunks; ++i){
+        int bin_length = array_length(triangle_bins[i]);
+        if(bin_length == 0) continue;
+
+        int offset = array_length(triangles_to_render);
+        triangles_to_render = array_hold(triangles_to_render, bin_length, sizeof(triangle_t));
+        memcpy(&triangles_to_render[offset], triangle_bins[i], sizeof(triangle_t) * bin_length);
     }
 
-    array_free(triangles_to_render);
-    
+    profile_stop(PROFILE_MERGE_BINS, stage_start);
+}
+
+void update(void){
+    // capping the frame rate only makes sense when presenting to a screen;
+    // headless frames run back to back
+    if(!is_headless){
+        int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
+        if(time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) SDL_Delay(time_to_wait);
+
+        previous_frame_time = SDL_GetTicks();
+    }
+
+    // the frame is timed from here, so the wait above is never part of it
+    profile_begin_frame(frame_index);
+
+    // the levels the last frame sampled are kept resident (or brought back) first
+    uint64_t stage_start = profile_start();
+    update_texture_residency();
+    // and headless frames wait for the levels it brings back, like they did for the first frame
+    if(options.headless && !options.stream_textures) finish_texture_streaming();
+    profile_stop(PROFILE_TEXTURE_RESIDENCY, stage_start);
+
+    int num_of_meshes = get_num_meshes();
+
+    // moving the meshes, refitting the hierarchy around their new bounds and finding the
+    // ones in view; the others skip the vertex and face stages entirely
+    stage_start = profile_start();
+
+    for(int i = 0; i < num_of_meshes; ++i){
+        mesh_t* mesh = get_mesh(i);
+
+        // mesh->rotation.x += 0.01;
+        mesh->rotation.y += 0.01;
+        // mesh->rotation.z += 0.005;
+
+        // the world matrix is the same for every vertex of the mesh, so it's built once per frame
+        mesh->world_matrix = make_world_matrix(mesh->scale, mesh->rotation, mesh->translation);
+        bvh_set_item(
+            &scene_bvh, i,
+            aabb_transform(mesh->bounds, mesh->world_matrix),
+            bounding_sphere_transform(mesh->bounding_sphere, mesh->world_matrix)
+        );
+    }
+    bvh_refit(&scene_bvh);
+    visible_meshes = bvh_cull(&scene_bvh, &view_frustum, visible_meshes);
+
+    profile_stop(PROFILE_FRUSTUM_CULL, stage_start);
+
+    array_reset(triangles_to_render);
+    for(int i = 0; i < array_length(visible_meshes); ++i){
+        process_mesh(get_mesh(visible_meshes[i]));
+    }
+
+    // sorting the triangles to render by their average depth, only when the render
+    // method draws something that isn't depth tested
+    if(raster_needs_painter_order()){
+        uint64_t sort_start = profile_start();
+        int num_of_triangles = array_length(triangles_to_render);
+        sort_triangles(triangles_to_render, num_of_triangles);
+        profile_stop(PROFILE_SORT, sort_start);
+    }
+}
+
+// handling the rendering process
+void render(void){
+    if(!is_headless) SDL_RenderClear(renderer);
+
+    // clearing the buffers and drawing the grid and triangles, tile by tile
+    num_triangles_rendered = array_length(triangles_to_render);
+    rasterize_triangles(triangles_to_render, num_triangles_rendered);
+
+    uint64_t stage_start = profile_start();
     render_color_buffer();
-    clear_color_buffer(0xFF000000);
-    clear_z_buffer();
+    profile_stop(PROFILE_RENDER_COLOR_BUFFER, stage_start);
+
+    // the buffers stay untouched until the next frame clears them tile by tile
+    if(options.output_filename != NULL){
+        char filename[1024];
+        snprintf(filename, sizeof(filename), options.output_filename, frame_index);
+        save_color_buffer(filename);
+    }
+
+    profile_end_frame();
 
     // this function updates the screen with any rendering performed  
     // since the previous call. it swaps the back buffer with the fron buffer,
     // displaying the current rendering result on the screen.
-    SDL_RenderPresent(renderer);
+    if(!is_headless) SDL_RenderPresent(renderer);
 }
 
 void free_resources(void){
+    profile_free();
+    free(transformed_vertices);
+    for(int i = 0; i < thread_pool_size(); ++i){
+        array_free(triangle_bins[i]);
+    }
+    free(triangle_bins);
+    array_free(triangles_to_render);
+    sort_free();
+    raster_free();
+    thread_pool_free();
     free(color_buffer);
     free(z_buffer);
-    upng_free(png_texture);
-    array_free(mesh.faces);
-    array_free(mesh.vertices);
+    free(hiz_buffer);
+    bvh_free(&scene_bvh);
+    array_free(visible_meshes);
+    array_free(visible_meshlets);
+    free_meshes();
+    free_textures();
+}
+
+// timing the full update() + render() pipeline for every render method, back to back
+void run_benchmark(void){
+    // frames used to warm up caches and the allocator; they are not timed
+    int num_warmup_frames = 5;
+    double* frame_times = (double*)malloc(sizeof(double) * options.frames);
+
+    int num_of_faces = 0;
+    for(int i = 0; i < get_num_meshes(); ++i){
+        num_of_faces += get_mesh(i)->lods[0].num_faces;
+    }
+    bench_begin_report(options.obj_filename, window_width, window_height, num_of_faces);
+
+    for(int method = RENDER_WIRE; method <= RENDER_TEXTURED_WIRE; ++method){
+        render_method = method;
+
+        // every render method sees the same sequence of frames
+        for(int i = 0; i < get_num_meshes(); ++i){
+            get_mesh(i)->rotation = (vec3_t){ 0, 0, 0 };
+        }
+
+        for(int i = 0; i < num_warmup_frames; ++i){
+            update();
+            render();
+        }
+
+        bench_result_t result = {
+            .render_method = render_method_names[method][0],
+            .num_frames = options.frames,
+            .frame_times = frame_times,
+            .num_triangles = 0,
+            .num_pixels = (long long)window_width * window_height * options.frames
+        };
+
+        for(int i = 0; i < options.frames; ++i){
+            double start_time = timer_now_ms();
+            update();
+            render();
+            frame_times[i] = timer_now_ms() - start_time;
+            result.num_triangles += num_triangles_rendered;
+        }
+
+        bench_report_result(&result, method == RENDER_WIRE);
+    }
+
+    bench_end_report();
+    free(frame_times);
 }
 
 // MAIN FUNCTION
-int main(void){
-    is_running = initialize_window();
+int main(int argc, char* argv[]){
+    if(!parse_arguments(argc, argv)){
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if(options.headless){
+        is_running = initialize_headless(options.width, options.height);
+    } else {
+        is_running = initialize_window();
+    }
 
     setup();
 
+    if(is_running && options.bench){
+        run_benchmark();
+        is_running = false;
+    }
+
     while(is_running){
         process_input();
         update();
         render();
+
+        ++frame_index;
+        if(options.frames > 0 && frame_index >= options.frames) is_running = false;
     }
 
+    if(options.profile_filename != NULL) profile_dump_csv(options.profile_filename);
+
     destroy_window();
     free_resources();
 
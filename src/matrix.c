@@ -71,8 +71,9 @@ mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar) {
     mat4_t m = {{{ 0 }}};
     m.m[0][0] = aspect * (1 / tan(fov / 2));
     m.m[1][1] = 1 / tan(fov / 2);
-    m.m[2][2] = zfar / (zfar / znear);
-    m.m[3][3] = (-zfar * znear) / (zfar - znear);
+    // z maps to [0, 1] between znear and zfar, w keeps the view space z
+    m.m[2][2] = zfar / (zfar - znear);
+    m.m[2][3] = (-zfar * znear) / (zfar - znear);
     m.m[3][2] = 1.0;
 
     return m; 
@@ -1,15 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "headers/array.h"
 #include "headers/mesh.h"
+#include "headers/mesh_cache.h"
+#include "headers/obj.h"
+#include "headers/vertex_cache.h"
+#include "headers/simplify.h"
 
-mesh_t mesh = {
-    .vertices = NULL,
-    .faces = NULL,
-    .rotation = {0, 0, 0},
-    .scale = {1.0, 1.0, 1.0},
-    .translation = {0, 0, 0}
-};
+// dynamic array of every mesh in the scene
+static mesh_t* meshes = NULL;
 
 vec3_t cube_vertices[N_CUBE_VERTICES] = {
     {.x = -1, .y = -1, .z = -1}, {.x = -1, .y =  1, .z = -1},
@@ -21,89 +21,232 @@ vec3_t cube_vertices[N_CUBE_VERTICES] = {
     {.x = -1, .y = -1, .z =  1}
 };
 
-face_t cube_faces[N_CUBE_FACES] = {
+// the cube as an .obj would have it: positions and uvs per corner, indexed by the loader
+typedef struct {
+    int a;
+    int b;
+    int c;
+    tex2_t a_uv;
+    tex2_t b_uv;
+    tex2_t c_uv;
+} cube_face_t;
+
+static cube_face_t cube_faces[N_CUBE_FACES] = {
     // front
-    { .a = 1, .b = 2, .c = 3, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 }, .color = 0xFFFFFFFF },
-    { .a = 1, .b = 3, .c = 4, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF },
+    { .a = 1, .b = 2, .c = 3, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 } },
+    { .a = 1, .b = 3, .c = 4, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 } },
     // right
-    { .a = 4, .b = 3, .c = 5, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 }, .color = 0xFFFFFFFF },
-    { .a = 4, .b = 5, .c = 6, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF },
+    { .a = 4, .b = 3, .c = 5, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 } },
+    { .a = 4, .b = 5, .c = 6, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 } },
     // back
-    { .a = 6, .b = 5, .c = 7, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 }, .color = 0xFFFFFFFF },
-    { .a = 6, .b = 7, .c = 8, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF },
+    { .a = 6, .b = 5, .c = 7, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 } },
+    { .a = 6, .b = 7, .c = 8, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 } },
     // left
-    { .a = 8, .b = 7, .c = 2, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 }, .color = 0xFFFFFFFF },
-    { .a = 8, .b = 2, .c = 1, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF },
+    { .a = 8, .b = 7, .c = 2, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 } },
+    { .a = 8, .b = 2, .c = 1, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 } },
     // top
-    { .a = 2, .b = 7, .c = 5, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 }, .color = 0xFFFFFFFF },
-    { .a = 2, .b = 5, .c = 3, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF },
+    { .a = 2, .b = 7, .c = 5, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 } },
+    { .a = 2, .b = 5, .c = 3, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 } },
     // bottom
-    { .a = 6, .b = 8, .c = 1, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 }, .color = 0xFFFFFFFF },
-    { .a = 6, .b = 1, .c = 4, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF }
+    { .a = 6, .b = 8, .c = 1, .a_uv = { 0, 1 }, .b_uv = { 0, 0 }, .c_uv = { 1, 0 } },
+    { .a = 6, .b = 1, .c = 4, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 } }
 };
 
-void load_cube_mesh_data(void){
-    for(int i = 0; i < N_CUBE_VERTICES; ++i){
-        vec3_t cube_vertex = cube_vertices[i];
-        array_push(mesh.vertices, cube_vertex);
+// simplifying the mesh into its levels of detail and building the meshlets of every level;
+// the vertices, faces and meshlets of the levels go one after the other in the mesh's arrays
+static void build_mesh_lods(mesh_t* mesh){
+    int num_vertices = array_length(mesh->vertices);
+    simplified_level_t levels[MESH_MAX_LODS] = { { mesh->faces, 0 } };
+    int num_levels = 1 + simplify_mesh(mesh->vertices, num_vertices, mesh->faces, array_length(mesh->faces), &levels[1], MESH_MAX_LODS - 1);
+
+    vec3_t* vertices = NULL;
+    tex2_t* uvs = NULL;
+    face_t* faces = NULL;
+    meshlet_t* meshlets = NULL;
+    for(int i = 0; i < num_levels; ++i){
+        // build_meshlets() replaces the vertices with the ones its meshlets use
+        mesh_t level = { .faces = levels[i].faces };
+        if(num_vertices > 0){
+            level.vertices = array_hold(NULL, num_vertices, sizeof(vec3_t));
+            level.uvs = array_hold(NULL, num_vertices, sizeof(tex2_t));
+            memcpy(level.vertices, mesh->vertices, sizeof(vec3_t) * num_vertices);
+            memcpy(level.uvs, mesh->uvs, sizeof(tex2_t) * num_vertices);
+        }
+        build_meshlets(&level);
+
+        int first_vertex = array_length(vertices);
+        int first_face = array_length(faces);
+        mesh->lods[i] = (mesh_lod_t){
+            .first_meshlet = array_length(meshlets),
+            .num_meshlets = array_length(level.meshlets),
+            .num_faces = array_length(level.faces),
+            .error = levels[i].error
+        };
+        for(int j = 0; j < array_length(level.meshlets); ++j){
+            meshlet_t meshlet = level.meshlets[j];
+            meshlet.first_vertex += first_vertex;
+            meshlet.first_face += first_face;
+            array_push(meshlets, meshlet);
+        }
+        for(int j = 0; j < array_length(level.faces); ++j){
+            face_t face = level.faces[j];
+            face.a += first_vertex;
+            face.b += first_vertex;
+            face.c += first_vertex;
+            array_push(faces, face);
+        }
+        for(int j = 0; j < array_length(level.vertices); ++j){
+            array_push(vertices, level.vertices[j]);
+            array_push(uvs, level.uvs[j]);
+        }
+
+        array_free(level.vertices);
+        array_free(level.uvs);
+        array_free(level.faces);
+        array_free(level.meshlets);
+    }
+
+    // level 0's faces were the mesh's, freed with the level above
+    array_free(mesh->vertices);
+    array_free(mesh->uvs);
+    mesh->vertices = vertices;
+    mesh->uvs = uvs;
+    mesh->faces = faces;
+    mesh->meshlets = meshlets;
+    mesh->num_lods = num_levels;
+    mesh->lod = 0;
+}
+
+// the levels of detail with their meshlets, the SoA copy and the bounds, once the vertices
+// and faces are loaded
+static void finish_mesh_data(mesh_t* mesh){
+    build_mesh_lods(mesh);
+
+    int num_vertices = array_length(mesh->vertices);
+    mesh->positions = vec3_soa_from_array(mesh->vertices, num_vertices);
+    mesh->bounds = aabb_from_points(mesh->vertices, num_vertices);
+    mesh->bounding_sphere = bounding_sphere_from_points(mesh->vertices, num_vertices, mesh->bounds);
+}
+
+// the vertex with the given position and uv, added when there's none yet
+static int get_cube_vertex(mesh_t* mesh, int position, tex2_t uv){
+    vec3_t cube_vertex = cube_vertices[position - 1];
+    for(int i = 0; i < array_length(mesh->vertices); ++i){
+        vec3_t vertex = mesh->vertices[i];
+        if(vertex.x == cube_vertex.x && vertex.y == cube_vertex.y && vertex.z == cube_vertex.z &&
+           mesh->uvs[i].u == uv.u && mesh->uvs[i].v == uv.v) return i;
     }
+    array_push(mesh->vertices, cube_vertex);
+    array_push(mesh->uvs, uv);
+    return array_length(mesh->vertices) - 1;
+}
 
+void load_cube_mesh_data(mesh_t* mesh){
     for(int i = 0; i < N_CUBE_FACES; ++i){
-        face_t cube_face = cube_faces[i];
-        array_push(mesh.faces, cube_face);
+        cube_face_t cube_face = cube_faces[i];
+        face_t face = {
+            .a = get_cube_vertex(mesh, cube_face.a, cube_face.a_uv),
+            .b = get_cube_vertex(mesh, cube_face.b, cube_face.b_uv),
+            .c = get_cube_vertex(mesh, cube_face.c, cube_face.c_uv),
+            .color = 0xFFFFFFFF
+        };
+        array_push(mesh->faces, face);
     }
+
+    finish_mesh_data(mesh);
+}
+
+// reordering the faces of a freshly parsed mesh for vertex reuse, and its vertices in the
+// order the faces use them; the meshlets are then grown in that order, so they come out
+// next to each other in memory and on screen as well
+static void optimize_mesh_order(mesh_t* mesh, char* filename){
+    int num_faces = array_length(mesh->faces);
+    int num_vertices = array_length(mesh->vertices);
+    if(num_faces == 0) return;
+
+    float miss_ratio = vertex_cache_miss_ratio(mesh->faces, num_faces, 0, num_vertices);
+    optimize_face_order(mesh->faces, num_faces, 0, num_vertices);
+    optimize_vertex_order(mesh->faces, num_faces, mesh->vertices, mesh->uvs, 0, num_vertices);
+    float optimized_miss_ratio = vertex_cache_miss_ratio(mesh->faces, num_faces, 0, num_vertices);
+
+    fprintf(stderr, "%s: %d faces, average cache miss ratio %.3f -> %.3f (FIFO of %d vertices)\n",
+        filename, num_faces, miss_ratio, optimized_miss_ratio, VERTEX_CACHE_SIZE);
 }
 
-void load_obj_file_data(char* filename){
-    FILE* file;
-    file = fopen(filename, "r"); // opening the file (using the filepath) with 'read' access    
+void load_obj_file_data(mesh_t* mesh, char* filename, bool reorder){
+    if(!load_obj_file(filename, &mesh->vertices, &mesh->uvs, &mesh->faces)) return;
+
+    if(reorder) optimize_mesh_order(mesh, filename);
+    finish_mesh_data(mesh);
+}
 
-    if(!file){
-        printf("Error: Could not open the file %s\n", filename);
-        return;
+// loading a mesh and its texture into the scene; returns its index. with use_cache, the
+// mesh comes from the cache next to the .obj when it's up to date, and the cache is
+// (re)written after parsing the .obj when it isn't. with reorder, the faces and vertices
+// are reordered for locality instead of staying in the order of the file
+int load_mesh(char* obj_filename, char* png_filename, bool use_cache, bool reorder, vec3_t scale, vec3_t translation, vec3_t rotation){
+    mesh_t mesh = {
+        .vertices = NULL,
+        .uvs = NULL,
+        .faces = NULL,
+        .meshlets = NULL,
+        .positions = { NULL, NULL, NULL },
+        .texture = NULL,
+        .is_instance = false,
+        .mapping = NULL,
+        .mapping_size = 0,
+        .rotation = rotation,
+        .scale = scale,
+        .translation = translation
+    };
+    if(!use_cache || !load_mesh_cache(&mesh, obj_filename, reorder)){
+        load_obj_file_data(&mesh, obj_filename, reorder);
+        if(use_cache && array_length(mesh.faces) > 0) save_mesh_cache(&mesh, obj_filename, reorder);
     }
+    mesh.texture = acquire_texture(png_filename, use_cache);
 
-    char line[1024];
+    array_push(meshes, mesh);
+    return array_length(meshes) - 1;
+}
 
-    tex2_t* tex_coords = NULL;
+// another copy of a mesh somewhere else in the scene, sharing its geometry and texture
+int add_mesh_instance(int mesh_index, vec3_t scale, vec3_t translation, vec3_t rotation){
+    mesh_t instance = meshes[mesh_index];
+    instance.is_instance = true;
+    instance.rotation = rotation;
+    instance.scale = scale;
+    instance.translation = translation;
 
-    while(fgets(line, 1024, file)){
-        if(strncmp(line, "v ", 2) == 0){
-            vec3_t vertex;
-            sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-            array_push(mesh.vertices, vertex);
-        }
+    array_push(meshes, instance);
+    return array_length(meshes) - 1;
+}
 
-        if(strncmp(line, "vt ", 3) == 0){
-            tex2_t tex_coord;
-            sscanf(line, "vt %f %f", &tex_coord.u, &tex_coord.v);
-            array_push(tex_coords, tex_coord);
-        }
+int get_num_meshes(void){
+    return array_length(meshes);
+}
+
+// the pointer stays valid until the next mesh is added
+mesh_t* get_mesh(int mesh_index){
+    return &meshes[mesh_index];
+}
+
+void free_meshes(void){
+    for(int i = 0; i < array_length(meshes); ++i){
+        mesh_t* mesh = &meshes[i];
+        if(mesh->is_instance) continue;
 
-        if(strncmp(line, "f ", 2) == 0){
-            int vertex_indices[3];
-            int texture_indices[3];
-            int normal_indices[3];
-            sscanf(
-                line, 
-                "f %d/%d/%d %d/%d/%d %d/%d/%d", 
-                &vertex_indices[0], &texture_indices[0], &normal_indices[0],
-                &vertex_indices[1], &texture_indices[1], &normal_indices[1],
-                &vertex_indices[2], &texture_indices[2], &normal_indices[2]
-            );
-            face_t face = {
-                .a = vertex_indices[0] - 1,
-                .b = vertex_indices[1] - 1,
-                .c = vertex_indices[2] - 1,
-                .a_uv = tex_coords[texture_indices[0] - 1],
-                .b_uv = tex_coords[texture_indices[1] - 1],
-                .c_uv = tex_coords[texture_indices[2] - 1],
-                .color = 0xFFFFFFFF
-            };
-            array_push(mesh.faces, face);
+        if(mesh->mapping != NULL){
+            unmap_mesh_cache(mesh);
+        } else {
+            array_free(mesh->faces);
+            array_free(mesh->meshlets);
+            array_free(mesh->uvs);
+            array_free(mesh->vertices);
+            vec3_soa_free(&mesh->positions);
         }
+        release_texture(mesh->texture);
     }
-    array_free(tex_coords);
-    fclose(file); // closing the file
+    array_free(meshes);
+    meshes = NULL;
 }
 
@@ -0,0 +1,302 @@
+// mmap(), stat() and friends are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers/mesh_cache.h"
+#include "headers/array.h"
+
+// every section starts on a cache line (and SIMD load) boundary
+#define SECTION_ALIGNMENT 64
+
+enum mesh_cache_section {
+    SECTION_VERTICES,
+    SECTION_UVS,
+    SECTION_FACES,
+    SECTION_MESHLETS,
+    SECTION_POSITIONS_X,
+    SECTION_POSITIONS_Y,
+    SECTION_POSITIONS_Z,
+    NUM_SECTIONS
+};
+
+typedef struct {
+    uint64_t offset;    // from the start of the file to the first item
+    int32_t count;
+    int32_t item_size;
+    bool is_array;      // preceded by the (capacity, length) header of array.h, so it can be used as one
+} mesh_cache_section_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;   // the sizes catch a cache written by a build with other struct layouts
+    uint32_t face_size;
+    uint32_t meshlet_size;
+    int64_t source_size;
+    int64_t source_mtime_ns;
+    uint32_t is_reordered;
+    aabb_t bounds;
+    bounding_sphere_t bounding_sphere;
+    mesh_lod_t lods[MESH_MAX_LODS];
+    int32_t num_lods;
+    mesh_cache_section_t sections[NUM_SECTIONS];
+    uint64_t file_size;
+} mesh_cache_header_t;
+
+// the header of array.h, in front of the items of the array sections
+typedef struct {
+    int capacity;
+    int occupied;
+} array_header_t;
+
+// the modification time of a file, in nanoseconds
+static int64_t get_mtime_ns(struct stat* file_stat) {
+#ifdef __APPLE__
+    struct timespec mtime = file_stat->st_mtimespec;
+#else
+    struct timespec mtime = file_stat->st_mtim;
+#endif
+    return (int64_t)mtime.tv_sec * 1000000000 + mtime.tv_nsec;
+}
+
+static void get_cache_filename(char* obj_filename, char* cache_filename, size_t size) {
+    snprintf(cache_filename, size, "%s%s", obj_filename, MESH_CACHE_EXTENSION);
+}
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) & ~(uint64_t)(SECTION_ALIGNMENT - 1);
+}
+
+static bool is_range_valid(int first, int count, int total) {
+    return first >= 0 && count >= 0 && first <= total - count;
+}
+
+// every meshlet's faces and vertices are ranges of the mesh's, and its faces only use its own
+// vertices (the vertex stage transforms nothing else); every other face stays within the vertices
+static bool are_meshlets_valid(meshlet_t* meshlets, int num_meshlets, face_t* faces, int num_faces, int num_vertices) {
+    for(int i = 0; i < num_faces; ++i){
+        if(!is_range_valid(faces[i].a, 1, num_vertices) || !is_range_valid(faces[i].b, 1, num_vertices) || !is_range_valid(faces[i].c, 1, num_vertices)) return false;
+    }
+
+    for(int i = 0; i < num_meshlets; ++i){
+        meshlet_t* meshlet = &meshlets[i];
+        if(!is_range_valid(meshlet->first_face, meshlet->num_faces, num_faces)) return false;
+        if(!is_range_valid(meshlet->first_vertex, meshlet->num_vertices, num_vertices)) return false;
+
+        for(int j = meshlet->first_face; j < meshlet->first_face + meshlet->num_faces; ++j){
+            face_t* face = &faces[j];
+            if(!is_range_valid(face->a - meshlet->first_vertex, 1, meshlet->num_vertices) ||
+                !is_range_valid(face->b - meshlet->first_vertex, 1, meshlet->num_vertices) ||
+                !is_range_valid(face->c - meshlet->first_vertex, 1, meshlet->num_vertices)) return false;
+        }
+    }
+    return true;
+}
+
+// mapping the cache of an .obj and pointing the mesh's arrays into it; false (with the mesh
+// untouched) when there's no cache or it doesn't match the .obj anymore
+bool load_mesh_cache(mesh_t* mesh, char* obj_filename, bool is_reordered) {
+    char cache_filename[1024];
+    get_cache_filename(obj_filename, cache_filename, sizeof(cache_filename));
+
+    struct stat source_stat;
+    if(stat(obj_filename, &source_stat) != 0) return false;
+
+    int fd = open(cache_filename, O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat cache_stat;
+    if(fstat(fd, &cache_stat) != 0 || cache_stat.st_size < (off_t)sizeof(mesh_cache_header_t)){
+        close(fd);
+        return false;
+    }
+
+    // private and writable, so the arrays behave like the ones the loader allocates
+    // (writes go to private copies of the pages, never to the file)
+    size_t size = cache_stat.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) return false;
+
+    mesh_cache_header_t* header = (mesh_cache_header_t*)mapping;
+    bool is_valid =
+        header->magic == MESH_CACHE_MAGIC &&
+        header->version == MESH_CACHE_VERSION &&
+        header->header_size == sizeof(mesh_cache_header_t) &&
+        header->face_size == sizeof(face_t) &&
+        header->meshlet_size == sizeof(meshlet_t) &&
+        header->source_size == (int64_t)source_stat.st_size &&
+        header->source_mtime_ns == get_mtime_ns(&source_stat) &&
+        header->is_reordered == is_reordered &&
+        header->file_size == size;
+
+    // a truncated or corrupt file mustn't send the arrays past the end of the mapping
+    static const int32_t item_sizes[NUM_SECTIONS] = {
+        sizeof(vec3_t), sizeof(tex2_t), sizeof(face_t), sizeof(meshlet_t), sizeof(float), sizeof(float), sizeof(float)
+    };
+    for(int i = 0; i < NUM_SECTIONS && is_valid; ++i){
+        mesh_cache_section_t* section = &header->sections[i];
+        is_valid = section->count >= 0 &&
+            section->item_size == item_sizes[i] &&
+            section->is_array == (i < SECTION_POSITIONS_X) &&
+            section->offset >= sizeof(mesh_cache_header_t) + (section->is_array ? sizeof(array_header_t) : 0) &&
+            section->offset <= size &&
+            (uint64_t)section->count * section->item_size <= size - section->offset;
+        if(is_valid && section->is_array){
+            array_header_t* array = (array_header_t*)((char*)mapping + section->offset) - 1;
+            is_valid = array->occupied == section->count && array->capacity == section->count;
+        }
+    }
+    is_valid = is_valid &&
+        header->sections[SECTION_UVS].count == header->sections[SECTION_VERTICES].count &&
+        header->sections[SECTION_POSITIONS_X].count == header->sections[SECTION_VERTICES].count &&
+        header->sections[SECTION_POSITIONS_Y].count == header->sections[SECTION_VERTICES].count &&
+        header->sections[SECTION_POSITIONS_Z].count == header->sections[SECTION_VERTICES].count;
+
+    // and the levels of detail mustn't send the renderer past the end of the meshlets
+    is_valid = is_valid && header->num_lods >= 1 && header->num_lods <= MESH_MAX_LODS;
+    for(int i = 0; i < header->num_lods && is_valid; ++i){
+        mesh_lod_t* lod = &header->lods[i];
+        is_valid = lod->first_meshlet >= 0 && lod->num_meshlets >= 0 &&
+            lod->first_meshlet <= header->sections[SECTION_MESHLETS].count - lod->num_meshlets;
+    }
+
+    // nor the meshlets and faces past the end of the faces and vertices
+    is_valid = is_valid && are_meshlets_valid(
+        (meshlet_t*)((char*)mapping + header->sections[SECTION_MESHLETS].offset), header->sections[SECTION_MESHLETS].count,
+        (face_t*)((char*)mapping + header->sections[SECTION_FACES].offset), header->sections[SECTION_FACES].count,
+        header->sections[SECTION_VERTICES].count
+    );
+
+    if(!is_valid){
+        munmap(mapping, size);
+        return false;
+    }
+
+    char* base = (char*)mapping;
+    // an empty array is NULL, as array.h has it
+    mesh->vertices = header->sections[SECTION_VERTICES].count > 0 ? (vec3_t*)(base + header->sections[SECTION_VERTICES].offset) : NULL;
+    mesh->uvs = header->sections[SECTION_UVS].count > 0 ? (tex2_t*)(base + header->sections[SECTION_UVS].offset) : NULL;
+    mesh->faces = header->sections[SECTION_FACES].count > 0 ? (face_t*)(base + header->sections[SECTION_FACES].offset) : NULL;
+    mesh->meshlets = header->sections[SECTION_MESHLETS].count > 0 ? (meshlet_t*)(base + header->sections[SECTION_MESHLETS].offset) : NULL;
+    mesh->positions.x = (float*)(base + header->sections[SECTION_POSITIONS_X].offset);
+    mesh->positions.y = (float*)(base + header->sections[SECTION_POSITIONS_Y].offset);
+    mesh->positions.z = (float*)(base + header->sections[SECTION_POSITIONS_Z].offset);
+    mesh->bounds = header->bounds;
+    mesh->bounding_sphere = header->bounding_sphere;
+    memcpy(mesh->lods, header->lods, sizeof(mesh->lods));
+    mesh->num_lods = header->num_lods;
+    mesh->lod = 0;
+    mesh->mapping = mapping;
+    mesh->mapping_size = size;
+
+    return true;
+}
+
+// writing the padding up to `offset`, then the section
+static bool write_section(FILE* file, uint64_t* position, mesh_cache_section_t* section, void* items) {
+    static const char zeros[SECTION_ALIGNMENT] = { 0 };
+
+    uint64_t start = section->is_array ? section->offset - sizeof(array_header_t) : section->offset;
+    if(fwrite(zeros, 1, start - *position, file) != start - *position) return false;
+
+    if(section->is_array){
+        array_header_t array = { section->count, section->count };
+        if(fwrite(&array, sizeof(array), 1, file) != 1) return false;
+    }
+    size_t size = (size_t)section->count * section->item_size;
+    if(size > 0 && fwrite(items, 1, size, file) != size) return false;
+
+    *position = section->offset + size;
+    return true;
+}
+
+// writing the mesh as the cache of its .obj; written to a temporary file and renamed, so
+// another instance never maps a half written cache
+bool save_mesh_cache(mesh_t* mesh, char* obj_filename, bool is_reordered) {
+    struct stat source_stat;
+    if(stat(obj_filename, &source_stat) != 0) return false;
+
+    char cache_filename[1024];
+    char temp_filename[1040];
+    get_cache_filename(obj_filename, cache_filename, sizeof(cache_filename));
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", cache_filename);
+
+    int num_vertices = array_length(mesh->vertices);
+    mesh_cache_header_t header = {
+        .magic = MESH_CACHE_MAGIC,
+        .version = MESH_CACHE_VERSION,
+        .header_size = sizeof(mesh_cache_header_t),
+        .face_size = sizeof(face_t),
+        .meshlet_size = sizeof(meshlet_t),
+        .source_size = source_stat.st_size,
+        .source_mtime_ns = get_mtime_ns(&source_stat),
+        .is_reordered = is_reordered,
+        .bounds = mesh->bounds,
+        .bounding_sphere = mesh->bounding_sphere,
+        .num_lods = mesh->num_lods,
+        .sections = {
+            [SECTION_VERTICES] = { 0, num_vertices, sizeof(vec3_t), true },
+            [SECTION_UVS] = { 0, num_vertices, sizeof(tex2_t), true },
+            [SECTION_FACES] = { 0, array_length(mesh->faces), sizeof(face_t), true },
+            [SECTION_MESHLETS] = { 0, array_length(mesh->meshlets), sizeof(meshlet_t), true },
+            [SECTION_POSITIONS_X] = { 0, num_vertices, sizeof(float), false },
+            [SECTION_POSITIONS_Y] = { 0, num_vertices, sizeof(float), false },
+            [SECTION_POSITIONS_Z] = { 0, num_vertices, sizeof(float), false }
+        }
+    };
+    memcpy(header.lods, mesh->lods, sizeof(header.lods));
+    void* items[NUM_SECTIONS] = {
+        mesh->vertices, mesh->uvs, mesh->faces, mesh->meshlets,
+        mesh->positions.x, mesh->positions.y, mesh->positions.z
+    };
+
+    // the array header goes right before the items, which start on the alignment; the
+    // padding in front of a section is then always shorter than the alignment
+    uint64_t end = sizeof(mesh_cache_header_t);
+    for(int i = 0; i < NUM_SECTIONS; ++i){
+        mesh_cache_section_t* section = &header.sections[i];
+        section->offset = align_offset(end + (section->is_array ? sizeof(array_header_t) : 0));
+        end = section->offset + (uint64_t)section->count * section->item_size;
+    }
+    header.file_size = end;
+
+    FILE* file = fopen(temp_filename, "wb");
+    if(!file){
+        fprintf(stderr, "Error: Could not write the mesh cache %s\n", cache_filename);
+        return false;
+    }
+
+    uint64_t position = sizeof(header);
+    bool is_written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for(int i = 0; i < NUM_SECTIONS && is_written; ++i){
+        is_written = write_section(file, &position, &header.sections[i], items[i]);
+    }
+    is_written = (fclose(file) == 0) && is_written;
+
+    if(!is_written || rename(temp_filename, cache_filename) != 0){
+        fprintf(stderr, "Error: Could not write the mesh cache %s\n", cache_filename);
+        remove(temp_filename);
+        return false;
+    }
+    return true;
+}
+
+void unmap_mesh_cache(mesh_t* mesh) {
+    if(mesh->mapping == NULL) return;
+
+    munmap(mesh->mapping, mesh->mapping_size);
+    mesh->mapping = NULL;
+    mesh->mapping_size = 0;
+    mesh->vertices = NULL;
+    mesh->uvs = NULL;
+    mesh->faces = NULL;
+    mesh->meshlets = NULL;
+    mesh->positions = (vec3_soa_t){ NULL, NULL, NULL };
+}
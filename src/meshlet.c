@@ -0,0 +1,215 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headers/meshlet.h"
+#include "headers/mesh.h"
+#include "headers/array.h"
+
+// the unit normal of a face (the same way round as the face stage computes it); the zero
+// vector for degenerate faces, which have no direction to cull by
+static vec3_t face_normal(vec3_t* vertices, face_t* face) {
+    vec3_t ab = vec3_sub(vertices[face->b], vertices[face->a]);
+    vec3_t ac = vec3_sub(vertices[face->c], vertices[face->a]);
+    vec3_t normal = vec3_cross(ab, ac);
+
+    float length = vec3_length(normal);
+    if(!(length > 0)) return (vec3_t){ 0, 0, 0 };
+    return vec3_div(normal, length);
+}
+
+// the cone around the average normal that holds every face normal of the meshlet
+static void compute_meshlet_cone(meshlet_t* meshlet, vec3_t* face_normals) {
+    meshlet->has_cone = false;
+
+    vec3_t axis = { 0, 0, 0 };
+    for(int i = 0; i < meshlet->num_faces; ++i){
+        axis = vec3_add(axis, face_normals[i]);
+    }
+    float length = vec3_length(axis);
+    if(!(length > 0)) return;
+    axis = vec3_div(axis, length);
+
+    float min_dot = 1;
+    for(int i = 0; i < meshlet->num_faces; ++i){
+        vec3_t normal = face_normals[i];
+        if(normal.x == 0 && normal.y == 0 && normal.z == 0) continue;
+        min_dot = fminf(min_dot, vec3_dot(axis, normal));
+    }
+
+    // a cone of 90 degrees or more can't be entirely facing away from any point
+    if(min_dot <= 0) return;
+
+    meshlet->has_cone = true;
+    meshlet->cone_axis = axis;
+    meshlet->cone_cos = min_dot;
+    meshlet->cone_sin = sqrtf(1 - min_dot * min_dot);
+}
+
+// splitting the faces into meshlets, growing each one from the first face that isn't in
+// one yet through the faces sharing a vertex with it (breadth first), until it's full or
+// runs out of neighbours that fit. the faces are reordered meshlet by meshlet, and the
+// vertices (with their uvs) are copied meshlet by meshlet, so every meshlet is a range of both
+void build_meshlets(mesh_t* mesh) {
+    vec3_t* vertices = mesh->vertices;
+    face_t* faces = mesh->faces;
+    int num_vertices = array_length(vertices);
+    int num_faces = array_length(faces);
+
+    mesh->meshlets = NULL;
+    if(num_faces == 0) return;
+
+    // the faces around each vertex: vertex_faces[vertex_face_offsets[v] ..] up to the next offset
+    int* vertex_face_offsets = (int*)calloc(num_vertices + 1, sizeof(int));
+    int* vertex_faces = (int*)malloc(sizeof(int) * num_faces * 3);
+    for(int i = 0; i < num_faces; ++i){
+        ++vertex_face_offsets[faces[i].a + 1];
+        ++vertex_face_offsets[faces[i].b + 1];
+        ++vertex_face_offsets[faces[i].c + 1];
+    }
+    for(int v = 0; v < num_vertices; ++v){
+        vertex_face_offsets[v + 1] += vertex_face_offsets[v];
+    }
+    int* fill = (int*)malloc(sizeof(int) * num_vertices);
+    memcpy(fill, vertex_face_offsets, sizeof(int) * num_vertices);
+    for(int i = 0; i < num_faces; ++i){
+        vertex_faces[fill[faces[i].a]++] = i;
+        vertex_faces[fill[faces[i].b]++] = i;
+        vertex_faces[fill[faces[i].c]++] = i;
+    }
+    free(fill);
+
+    vec3_t* normals = (vec3_t*)malloc(sizeof(vec3_t) * num_faces);
+    for(int i = 0; i < num_faces; ++i){
+        normals[i] = face_normal(vertices, &faces[i]);
+    }
+
+    bool* is_assigned = (bool*)calloc(num_faces, sizeof(bool));
+    // the meshlet a vertex was last copied into, and its index in the new vertices there
+    int* vertex_meshlet = (int*)malloc(sizeof(int) * num_vertices);
+    int* vertex_remap = (int*)malloc(sizeof(int) * num_vertices);
+    for(int v = 0; v < num_vertices; ++v){
+        vertex_meshlet[v] = -1;
+    }
+
+    face_t* new_faces = (face_t*)malloc(sizeof(face_t) * num_faces);
+    vec3_t* new_vertices = NULL;
+    tex2_t* new_uvs = NULL;
+    vec3_t meshlet_normals[MESHLET_MAX_FACES];
+    int* queue = NULL;
+    int num_new_faces = 0;
+
+    for(int seed = 0; seed < num_faces; ++seed){
+        if(is_assigned[seed]) continue;
+
+        int meshlet_index = array_length(mesh->meshlets);
+        meshlet_t meshlet = {
+            .first_face = num_new_faces,
+            .num_faces = 0,
+            .first_vertex = array_length(new_vertices),
+            .num_vertices = 0
+        };
+        vec3_t normal_sum = { 0, 0, 0 };
+
+        array_reset(queue);
+        array_push(queue, seed);
+
+        for(int head = 0; head < array_length(queue) && meshlet.num_faces < MESHLET_MAX_FACES; ++head){
+            int f = queue[head];
+            if(is_assigned[f]) continue;
+
+            face_t* face = &faces[f];
+            int corners[3] = { face->a, face->b, face->c };
+
+            int num_new_vertices = 0;
+            for(int k = 0; k < 3; ++k){
+                if(vertex_meshlet[corners[k]] != meshlet_index) ++num_new_vertices;
+            }
+            // a repeated corner (degenerate face) is counted twice; that only makes the limit stricter
+            if(meshlet.num_vertices + num_new_vertices > MESHLET_MAX_VERTICES) continue;
+
+            // the seed always goes in; the others have to point roughly the same way
+            if(meshlet.num_faces > 0 && vec3_length(normal_sum) > 0){
+                vec3_t average = vec3_div(normal_sum, vec3_length(normal_sum));
+                if(vec3_dot(average, normals[f]) < MESHLET_MIN_NORMAL_DOT) continue;
+            }
+
+            for(int k = 0; k < 3; ++k){
+                int v = corners[k];
+                if(vertex_meshlet[v] == meshlet_index) continue;
+                vertex_meshlet[v] = meshlet_index;
+                vertex_remap[v] = array_length(new_vertices);
+                array_push(new_vertices, vertices[v]);
+                array_push(new_uvs, mesh->uvs[v]);
+                ++meshlet.num_vertices;
+            }
+
+            face_t new_face = *face;
+            new_face.a = vertex_remap[face->a];
+            new_face.b = vertex_remap[face->b];
+            new_face.c = vertex_remap[face->c];
+            new_faces[num_new_faces++] = new_face;
+
+            meshlet_normals[meshlet.num_faces++] = normals[f];
+            normal_sum = vec3_add(normal_sum, normals[f]);
+            is_assigned[f] = true;
+
+            // every face sharing a vertex with this one is a candidate
+            for(int k = 0; k < 3; ++k){
+                int v = corners[k];
+                for(int j = vertex_face_offsets[v]; j < vertex_face_offsets[v + 1]; ++j){
+                    if(!is_assigned[vertex_faces[j]]) array_push(queue, vertex_faces[j]);
+                }
+            }
+        }
+
+        meshlet.bounding_sphere = bounding_sphere_from_points(
+            &new_vertices[meshlet.first_vertex], meshlet.num_vertices,
+            aabb_from_points(&new_vertices[meshlet.first_vertex], meshlet.num_vertices)
+        );
+        compute_meshlet_cone(&meshlet, meshlet_normals);
+        array_push(mesh->meshlets, meshlet);
+    }
+
+    memcpy(faces, new_faces, sizeof(face_t) * num_faces);
+    array_free(mesh->vertices);
+    array_free(mesh->uvs);
+    mesh->vertices = new_vertices;
+    mesh->uvs = new_uvs;
+
+    array_free(queue);
+    free(new_faces);
+    free(vertex_remap);
+    free(vertex_meshlet);
+    free(is_assigned);
+    free(normals);
+    free(vertex_faces);
+    free(vertex_face_offsets);
+}
+
+// whether any face of the meshlet can be visible: its sphere has to be (partly) inside the
+// frustum and, when culling backfaces, some face has to be able to face the camera
+bool meshlet_is_visible(meshlet_t* meshlet, mat4_t world_matrix, bool cull_backfaces, frustum_t* frustum, vec3_t camera) {
+    bounding_sphere_t sphere = bounding_sphere_transform(meshlet->bounding_sphere, world_matrix);
+    if(frustum_test_sphere(frustum, sphere) == FRUSTUM_OUTSIDE) return false;
+
+    if(!cull_backfaces || !meshlet->has_cone) return true;
+
+    // the world matrix only rotates and scales the axis (uniformly, see the caller)
+    vec4_t axis4 = mat4_mul_vec4(world_matrix, (vec4_t){ meshlet->cone_axis.x, meshlet->cone_axis.y, meshlet->cone_axis.z, 0 });
+    vec3_t axis = vec3_from_vec4(axis4);
+    vec3_normalise(&axis);
+
+    // a face is a backface when the camera is behind its plane: dot(normal, point - camera) > 0.
+    // with theta the angle between the axis and the direction from the camera to the center,
+    // the smallest dot(normal, center - camera) over the cone is distance * cos(theta + half angle),
+    // and moving from the center to any point of the meshlet changes it by less than the radius
+    vec3_t to_center = vec3_sub(sphere.center, camera);
+    float distance = vec3_length(to_center);
+    if(!(distance > sphere.radius)) return true;
+
+    float cos_theta = vec3_dot(to_center, axis) / distance;
+    float sin_theta = sqrtf(fmaxf(0, 1 - cos_theta * cos_theta));
+    float min_dot = distance * (cos_theta * meshlet->cone_cos - sin_theta * meshlet->cone_sin);
+
+    return !(min_dot > sphere.radius);
+}
@@ -0,0 +1,430 @@
+// mmap() and fstat() are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers/obj.h"
+#include "headers/array.h"
+#include "headers/thread_pool.h"
+
+// files are split into chunks of at least this many bytes, parsed in parallel
+#define MIN_OBJ_CHUNK_SIZE (1 << 20)
+// and into a few chunks per thread, so a chunk that's slow to parse doesn't hold everyone up
+#define OBJ_CHUNKS_PER_THREAD 4
+
+// the texture coordinate index of a face corner without one
+#define NO_TEX_COORD INT_MIN
+
+// a face as written in the file: 0-based indices, where the ones with their bit set in
+// `is_relative` (bits 0-2 vertices, 3-5 texture coordinates) were negative in the file
+// and are still relative to the start of the chunk
+typedef struct {
+    int vertices[3];
+    int tex_coords[3];
+    int is_relative;
+} obj_face_t;
+
+typedef struct {
+    const char* start;  // the chunk is whole lines, from start up to end
+    const char* end;
+    vec3_t* vertices;   // dynamic arrays of what the chunk's lines hold
+    tex2_t* tex_coords;
+    obj_face_t* faces;
+    int first_vertex;   // where the chunk's items go in the file's (prefix sums over the chunks)
+    int first_tex_coord;
+    int first_face;
+    int num_invalid_faces;
+} obj_chunk_t;
+
+// a face corner resolved against the whole file: the indices of its v and vt lines,
+// with tex_coord -1 when it has none
+typedef struct {
+    int position;
+    int tex_coord;
+} obj_corner_t;
+
+typedef struct {
+    obj_chunk_t* chunks;
+    vec3_t* positions;      // every v line of the file
+    tex2_t* tex_coords;     // every vt line
+    obj_corner_t* corners;  // three per face; the first one's position is -1 for invalid faces
+    int num_positions;
+    int num_tex_coords;
+} obj_context_t;
+
+static inline const char* skip_spaces(const char* p, const char* end) {
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    return p;
+}
+
+// the slow path of parse_float(): copying the number out, as strtof() needs it terminated
+static const char* parse_float_slow(const char* p, const char* end, float* value) {
+    char buffer[64];
+    int length = 0;
+    while(p + length < end && length < (int)sizeof(buffer) - 1 && strchr("+-.0123456789eE", p[length]) != NULL) ++length;
+    memcpy(buffer, p, length);
+    buffer[length] = '\0';
+
+    char* number_end;
+    *value = strtof(buffer, &number_end);
+    return p + (number_end - buffer);
+}
+
+// parsing a decimal float; up to 19 significant digits and exponents that keep the power
+// of ten exact in a double (the usual .obj numbers) take the fast path, which is exact up
+// to the final rounding to float. everything else goes through strtof()
+static const char* parse_float(const char* p, const char* end, float* value) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char* start = p;
+
+    bool is_negative = false;
+    if(p < end && (*p == '-' || *p == '+')){
+        is_negative = (*p == '-');
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int num_digits = 0;
+    int exponent = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; ++p){
+        if(num_digits == 0 && *p == '0') continue; // leading zeros don't count
+        mantissa = mantissa * 10 + (*p - '0');
+        ++num_digits;
+    }
+    bool has_digits = (p > start + (is_negative || *start == '+'));
+    if(p < end && *p == '.'){
+        ++p;
+        for(; p < end && *p >= '0' && *p <= '9'; ++p){
+            has_digits = true;
+            if(num_digits == 0 && *p == '0'){
+                --exponent;
+                continue;
+            }
+            mantissa = mantissa * 10 + (*p - '0');
+            ++num_digits;
+            --exponent;
+        }
+    }
+    if(!has_digits){
+        *value = 0;
+        return start;
+    }
+    if(p < end && (*p == 'e' || *p == 'E')) return parse_float_slow(start, end, value);
+    if(num_digits > 19 || exponent < -22) return parse_float_slow(start, end, value);
+
+    double result = (double)mantissa;
+    // a mantissa above 2^53 isn't exact in a double
+    if(mantissa > (1ull << 53)) return parse_float_slow(start, end, value);
+    result = (exponent < 0) ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+
+    *value = (float)(is_negative ? -result : result);
+    return p;
+}
+
+static const char* parse_int(const char* p, const char* end, int* value, bool* is_valid) {
+    bool is_negative = false;
+    if(p < end && (*p == '-' || *p == '+')){
+        is_negative = (*p == '-');
+        ++p;
+    }
+
+    const char* digits = p;
+    long long result = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; ++p){
+        if(result < INT_MAX) result = result * 10 + (*p - '0');
+    }
+    *is_valid = (p > digits) && result <= INT_MAX;
+    *value = (int)(is_negative ? -result : result);
+    return p;
+}
+
+// one corner of a face line: v, v/vt, v//vn or v/vt/vn. indices are turned 0-based;
+// negative (relative) ones become relative to the start of the chunk
+static const char* parse_face_corner(const char* p, const char* end, obj_chunk_t* chunk, int* vertex, int* tex_coord, int* is_relative, int corner) {
+    bool is_valid;
+    int index;
+
+    p = parse_int(p, end, &index, &is_valid);
+    if(!is_valid || index == 0) return NULL;
+    if(index > 0){
+        *vertex = index - 1;
+    } else {
+        *vertex = array_length(chunk->vertices) + index;
+        *is_relative |= 1 << corner;
+    }
+
+    *tex_coord = NO_TEX_COORD;
+    if(p < end && *p == '/'){
+        ++p;
+        if(p < end && *p != '/'){
+            p = parse_int(p, end, &index, &is_valid);
+            if(!is_valid || index == 0) return NULL;
+            if(index > 0){
+                *tex_coord = index - 1;
+            } else {
+                *tex_coord = array_length(chunk->tex_coords) + index;
+                *is_relative |= 1 << (3 + corner);
+            }
+        }
+        // the normal index isn't used
+        if(p < end && *p == '/'){
+            ++p;
+            p = parse_int(p, end, &index, &is_valid);
+        }
+    }
+    return p;
+}
+
+// a face line; polygons with more than 3 corners are split into a fan of triangles
+static void parse_face_line(const char* p, const char* end, obj_chunk_t* chunk) {
+    int vertices[3];
+    int tex_coords[3];
+    int is_relative = 0;
+    int num_corners = 0;
+
+    for(;;){
+        p = skip_spaces(p, end);
+        if(p >= end || *p == '#') break;
+
+        int corner = (num_corners < 3) ? num_corners : 2;
+        int corner_bits = (1 << corner) | (1 << (3 + corner));
+        is_relative &= ~corner_bits;
+
+        p = parse_face_corner(p, end, chunk, &vertices[corner], &tex_coords[corner], &is_relative, corner);
+        if(p == NULL){
+            ++chunk->num_invalid_faces;
+            return;
+        }
+        ++num_corners;
+
+        if(num_corners >= 3){
+            obj_face_t face = {
+                .vertices = { vertices[0], vertices[1], vertices[2] },
+                .tex_coords = { tex_coords[0], tex_coords[1], tex_coords[2] },
+                .is_relative = is_relative
+            };
+            array_push(chunk->faces, face);
+
+            // the next triangle of the fan shares the first corner and this one
+            vertices[1] = vertices[2];
+            tex_coords[1] = tex_coords[2];
+            int from_bits = (1 << 2) | (1 << 5);
+            int to_bits = (1 << 1) | (1 << 4);
+            is_relative = (is_relative & ~to_bits) | ((is_relative & from_bits) >> 1);
+        }
+    }
+    if(num_corners > 0 && num_corners < 3) ++chunk->num_invalid_faces;
+}
+
+static void parse_obj_chunk(void* context, int index, int thread) {
+    obj_chunk_t* chunk = &((obj_context_t*)context)->chunks[index];
+    const char* p = chunk->start;
+
+    while(p < chunk->end){
+        const char* line_end = memchr(p, '\n', chunk->end - p);
+        if(line_end == NULL) line_end = chunk->end;
+
+        const char* q = skip_spaces(p, line_end);
+        if(line_end - q >= 2 && q[0] == 'v' && (q[1] == ' ' || q[1] == '\t')){
+            vec3_t vertex = { 0, 0, 0 };
+            q = parse_float(skip_spaces(q + 2, line_end), line_end, &vertex.x);
+            q = parse_float(skip_spaces(q, line_end), line_end, &vertex.y);
+            parse_float(skip_spaces(q, line_end), line_end, &vertex.z);
+            array_push(chunk->vertices, vertex);
+        } else if(line_end - q >= 3 && q[0] == 'v' && q[1] == 't' && (q[2] == ' ' || q[2] == '\t')){
+            tex2_t tex_coord = { 0, 0 };
+            q = parse_float(skip_spaces(q + 3, line_end), line_end, &tex_coord.u);
+            parse_float(skip_spaces(q, line_end), line_end, &tex_coord.v);
+            array_push(chunk->tex_coords, tex_coord);
+        } else if(line_end - q >= 2 && q[0] == 'f' && (q[1] == ' ' || q[1] == '\t')){
+            parse_face_line(q + 2, line_end, chunk);
+        }
+
+        p = line_end + 1;
+    }
+}
+
+// copying the chunk's positions and texture coordinates to their place in the file's
+static void gather_obj_chunk_vertices(void* context, int index, int thread) {
+    obj_context_t* obj = (obj_context_t*)context;
+    obj_chunk_t* chunk = &obj->chunks[index];
+
+    int num_positions = array_length(chunk->vertices);
+    int num_tex_coords = array_length(chunk->tex_coords);
+    if(num_positions > 0) memcpy(&obj->positions[chunk->first_vertex], chunk->vertices, sizeof(vec3_t) * num_positions);
+    if(num_tex_coords > 0) memcpy(&obj->tex_coords[chunk->first_tex_coord], chunk->tex_coords, sizeof(tex2_t) * num_tex_coords);
+}
+
+// resolving the corners of the chunk's faces against the whole file; faces that point
+// past the positions (or texture coordinates) in the file are marked invalid
+static void gather_obj_chunk_faces(void* context, int index, int thread) {
+    obj_context_t* obj = (obj_context_t*)context;
+    obj_chunk_t* chunk = &obj->chunks[index];
+
+    for(int i = 0; i < array_length(chunk->faces); ++i){
+        obj_face_t* raw_face = &chunk->faces[i];
+        obj_corner_t* corners = &obj->corners[(chunk->first_face + i) * 3];
+        bool is_valid = true;
+
+        for(int k = 0; k < 3; ++k){
+            corners[k].position = raw_face->vertices[k] + ((raw_face->is_relative & (1 << k)) ? chunk->first_vertex : 0);
+            if(corners[k].position < 0 || corners[k].position >= obj->num_positions) is_valid = false;
+
+            corners[k].tex_coord = -1;
+            if(raw_face->tex_coords[k] != NO_TEX_COORD){
+                corners[k].tex_coord = raw_face->tex_coords[k] + ((raw_face->is_relative & (1 << (3 + k))) ? chunk->first_tex_coord : 0);
+                if(corners[k].tex_coord < 0 || corners[k].tex_coord >= obj->num_tex_coords) is_valid = false;
+            }
+        }
+        if(!is_valid){
+            corners[0].position = -1;
+            ++chunk->num_invalid_faces;
+        }
+    }
+}
+
+// the mesh's vertices are the distinct (position, texture coordinate) pairs of the corners,
+// numbered in the order the faces first use them. the lookup is a hash table keyed on the
+// position index (which needs no hashing): every position heads a chain of the vertices
+// made from it, which rarely has more than a few of them (one per uv seam)
+static void index_obj_vertices(obj_context_t* obj, int num_faces, vec3_t** vertices, tex2_t** uvs, face_t** faces) {
+    int* position_vertex = (int*)malloc(sizeof(int) * (obj->num_positions > 0 ? obj->num_positions : 1));
+    for(int i = 0; i < obj->num_positions; ++i){
+        position_vertex[i] = -1;
+    }
+    int* next_vertex = NULL;
+    int* vertex_tex_coord = NULL;
+    int first_vertex = array_length(*vertices);
+
+    for(int i = 0; i < num_faces; ++i){
+        obj_corner_t* corners = &obj->corners[i * 3];
+        if(corners[0].position < 0) continue;
+
+        int face_vertices[3];
+        for(int k = 0; k < 3; ++k){
+            int v = position_vertex[corners[k].position];
+            while(v != -1 && vertex_tex_coord[v] != corners[k].tex_coord){
+                v = next_vertex[v];
+            }
+            if(v == -1){
+                v = array_length(next_vertex);
+                array_push(next_vertex, position_vertex[corners[k].position]);
+                array_push(vertex_tex_coord, corners[k].tex_coord);
+                position_vertex[corners[k].position] = v;
+
+                tex2_t uv = { 0, 0 };
+                if(corners[k].tex_coord >= 0) uv = obj->tex_coords[corners[k].tex_coord];
+                array_push(*vertices, obj->positions[corners[k].position]);
+                array_push(*uvs, uv);
+            }
+            face_vertices[k] = first_vertex + v;
+        }
+
+        face_t face = {
+            .a = face_vertices[0],
+            .b = face_vertices[1],
+            .c = face_vertices[2],
+            .color = 0xFFFFFFFF
+        };
+        array_push(*faces, face);
+    }
+
+    array_free(vertex_tex_coord);
+    array_free(next_vertex);
+    free(position_vertex);
+}
+
+bool load_obj_file(char* filename, vec3_t** vertices, tex2_t** uvs, face_t** faces) {
+    int fd = open(filename, O_RDONLY);
+    struct stat file_stat;
+    if(fd < 0 || fstat(fd, &file_stat) != 0){
+        if(fd >= 0) close(fd);
+        fprintf(stderr, "Error: Could not open the file %s\n", filename);
+        return false;
+    }
+
+    size_t size = file_stat.st_size;
+    const char* data = NULL;
+    if(size > 0){
+        data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == (const char*)MAP_FAILED){
+            close(fd);
+            fprintf(stderr, "Error: Could not open the file %s\n", filename);
+            return false;
+        }
+        // read once from front to back
+        posix_madvise((void*)data, size, POSIX_MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    // splitting the file into chunks of whole lines
+    int num_chunks = (int)(size / MIN_OBJ_CHUNK_SIZE);
+    if(num_chunks > thread_pool_size() * OBJ_CHUNKS_PER_THREAD) num_chunks = thread_pool_size() * OBJ_CHUNKS_PER_THREAD;
+    if(num_chunks < 1) num_chunks = 1;
+
+    obj_context_t obj = { .chunks = (obj_chunk_t*)calloc(num_chunks, sizeof(obj_chunk_t)) };
+    const char* chunk_start = data;
+    for(int i = 0; i < num_chunks; ++i){
+        const char* chunk_end = data + (size_t)((double)size * (i + 1) / num_chunks);
+        if(i == num_chunks - 1) chunk_end = data + size;
+        if(chunk_end < chunk_start) chunk_end = chunk_start;
+        // moving the end past the newline of the line it falls in
+        if(chunk_end > data && chunk_end < data + size && chunk_end[-1] != '\n'){
+            const char* newline = memchr(chunk_end, '\n', data + size - chunk_end);
+            chunk_end = (newline != NULL) ? newline + 1 : data + size;
+        }
+        obj.chunks[i].start = chunk_start;
+        obj.chunks[i].end = chunk_end;
+        chunk_start = chunk_end;
+    }
+
+    thread_pool_run(parse_obj_chunk, &obj, num_chunks);
+
+    // where every chunk's items go: prefix sums of the counts of the chunks before it
+    int num_faces = 0;
+    for(int i = 0; i < num_chunks; ++i){
+        obj.chunks[i].first_vertex = obj.num_positions;
+        obj.chunks[i].first_tex_coord = obj.num_tex_coords;
+        obj.chunks[i].first_face = num_faces;
+        obj.num_positions += array_length(obj.chunks[i].vertices);
+        obj.num_tex_coords += array_length(obj.chunks[i].tex_coords);
+        num_faces += array_length(obj.chunks[i].faces);
+    }
+
+    obj.positions = (vec3_t*)malloc(sizeof(vec3_t) * (obj.num_positions > 0 ? obj.num_positions : 1));
+    obj.tex_coords = (tex2_t*)malloc(sizeof(tex2_t) * (obj.num_tex_coords > 0 ? obj.num_tex_coords : 1));
+    obj.corners = (obj_corner_t*)malloc(sizeof(obj_corner_t) * 3 * (num_faces > 0 ? num_faces : 1));
+
+    thread_pool_run(gather_obj_chunk_vertices, &obj, num_chunks);
+    thread_pool_run(gather_obj_chunk_faces, &obj, num_chunks);
+
+    index_obj_vertices(&obj, num_faces, vertices, uvs, faces);
+
+    int num_invalid_faces = 0;
+    for(int i = 0; i < num_chunks; ++i){
+        num_invalid_faces += obj.chunks[i].num_invalid_faces;
+        array_free(obj.chunks[i].vertices);
+        array_free(obj.chunks[i].tex_coords);
+        array_free(obj.chunks[i].faces);
+    }
+    if(num_invalid_faces > 0){
+        fprintf(stderr, "Error: %d faces in %s are malformed or point to missing vertices and were skipped\n", num_invalid_faces, filename);
+    }
+
+    free(obj.corners);
+    free(obj.tex_coords);
+    free(obj.positions);
+    free(obj.chunks);
+    if(data != NULL) munmap((void*)data, size);
+    return true;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headers/profile.h"
+
+bool profile_enabled = false;
+profile_frame_t profile_current_frame;
+
+// ring buffer with the last `history_size` frames; `history_next` is where
+// the next frame goes, so once it's full it overwrites the oldest one
+static profile_frame_t* history = NULL;
+static int history_size = 0;
+static int history_next = 0;
+static int history_count = 0;
+
+static uint64_t frame_start_time = 0;
+
+static char* stage_names[NUM_PROFILE_STAGES] = {
+    [PROFILE_TEXTURE_RESIDENCY] = "texture_residency",
+    [PROFILE_FRUSTUM_CULL] = "frustum_cull",
+    [PROFILE_MESHLET_CULL] = "meshlet_cull",
+    [PROFILE_VERTEX_TRANSFORM] = "vertex_transform",
+    [PROFILE_BACKFACE_CULL] = "backface_cull",
+    [PROFILE_CLIPPING] = "clipping",
+    [PROFILE_TRIANGLE_ASSEMBLY] = "triangle_assembly",
+    [PROFILE_MERGE_BINS] = "merge_bins",
+    [PROFILE_SORT] = "sort",
+    [PROFILE_BIN_TRIANGLES] = "bin_triangles",
+    [PROFILE_CLEAR_COLOR_BUFFER] = "clear_color_buffer",
+    [PROFILE_CLEAR_Z_BUFFER] = "clear_z_buffer",
+    [PROFILE_DRAW_GRID] = "draw_grid",
+    [PROFILE_RASTER_VERTICES] = "raster_vertices",
+    [PROFILE_RASTER_FILL] = "raster_fill",
+    [PROFILE_RASTER_TEXTURED] = "raster_textured",
+    [PROFILE_RASTER_WIRE] = "raster_wire",
+    [PROFILE_RENDER_COLOR_BUFFER] = "render_color_buffer",
+};
+
+void profile_init(int size) {
+    history = (profile_frame_t*)calloc(size, sizeof(profile_frame_t));
+    history_size = size;
+    history_next = 0;
+    history_count = 0;
+    profile_enabled = (history != NULL && size > 0);
+}
+
+void profile_begin_frame(int frame) {
+    if(!profile_enabled) return;
+
+    memset(&profile_current_frame, 0, sizeof(profile_current_frame));
+    profile_current_frame.frame = frame;
+    frame_start_time = timer_now_ns();
+}
+
+void profile_end_frame(void) {
+    if(!profile_enabled) return;
+
+    profile_current_frame.total_ns = timer_now_ns() - frame_start_time;
+
+    history[history_next] = profile_current_frame;
+    history_next = (history_next + 1) % history_size;
+    if(history_count < history_size) ++history_count;
+}
+
+// writing the frames in the ring buffer, oldest first; times are in milliseconds
+bool profile_dump_csv(char* filename) {
+    if(history == NULL) return false;
+
+    FILE* file = fopen(filename, "w");
+
+    if(!file){
+        fprintf(stderr, "Error: Could not open the file %s\n", filename);
+        return false;
+    }
+
+    fprintf(file, "frame");
+    for(int i = 0; i < NUM_PROFILE_STAGES; ++i) {
+        fprintf(file, ",%s", stage_names[i]);
+    }
+    fprintf(file, ",total\n");
+
+    int oldest = (history_next - history_count + history_size) % history_size;
+    for(int i = 0; i < history_count; ++i) {
+        profile_frame_t* frame = &history[(oldest + i) % history_size];
+
+        fprintf(file, "%d", frame->frame);
+        for(int j = 0; j < NUM_PROFILE_STAGES; ++j) {
+            fprintf(file, ",%.4f", frame->stage_ns[j] / 1000000.0);
+        }
+        fprintf(file, ",%.4f\n", frame->total_ns / 1000000.0);
+    }
+
+    fclose(file);
+    return true;
+}
+
+void profile_free(void) {
+    free(history);
+    history = NULL;
+    history_size = 0;
+    profile_enabled = false;
+}
@@ -0,0 +1,231 @@
+#include <math.h>
+#include "headers/raster.h"
+#include "headers/display.h"
+#include "headers/texture.h"
+#include "headers/array.h"
+#include "headers/profile.h"
+#include "headers/thread_pool.h"
+
+// how far the drawing of a triangle can reach past the bounding box of its points;
+// the vertex markers of RENDER_WIRE_VERTEX are the widest (draw_rect(x - 3, y - 3, 6, 6))
+#define TILE_BIN_MARGIN 4
+
+#if TILE_SIZE % HIZ_BLOCK_SIZE != 0
+#error "tiles must be made of whole hiz_buffer blocks"
+#endif
+
+static int num_tiles_x = 0;
+static int num_tiles_y = 0;
+static int num_tiles = 0;
+static int num_bin_chunks = 0;
+
+// triangle indices binned by tile: a dynamic array for every (chunk, tile) pair,
+// at tile_bins[(chunk * num_tiles) + tile]. each chunk is a contiguous range of
+// triangles binned by one thread, so walking the chunks in order keeps the
+// triangles of a tile in their original (painter's) order
+static int** tile_bins = NULL;
+
+typedef struct {
+    triangle_t* triangles;
+    int num_of_triangles;
+} raster_context_t;
+
+void raster_init(void) {
+    num_tiles_x = (window_width + TILE_SIZE - 1) / TILE_SIZE;
+    num_tiles_y = (window_height + TILE_SIZE - 1) / TILE_SIZE;
+    num_tiles = num_tiles_x * num_tiles_y;
+    num_bin_chunks = thread_pool_size();
+
+    tile_bins = (int**)calloc(num_bin_chunks * num_tiles, sizeof(int*));
+}
+
+static rect_t get_tile_rect(int tile) {
+    int tile_x = tile % num_tiles_x;
+    int tile_y = tile / num_tiles_x;
+
+    rect_t rect = {
+        .x0 = tile_x * TILE_SIZE,
+        .y0 = tile_y * TILE_SIZE,
+        .x1 = (tile_x + 1) * TILE_SIZE,
+        .y1 = (tile_y + 1) * TILE_SIZE
+    };
+    if(rect.x1 > window_width) rect.x1 = window_width;
+    if(rect.y1 > window_height) rect.y1 = window_height;
+
+    return rect;
+}
+
+// adding one range of triangles to every tile their screen bounding box touches
+static void bin_triangle_chunk(void* context, int chunk, int thread) {
+    raster_context_t* raster = (raster_context_t*)context;
+
+    int first = (int)((long long)raster->num_of_triangles * chunk / num_bin_chunks);
+    int last = (int)((long long)raster->num_of_triangles * (chunk + 1) / num_bin_chunks);
+
+    int** bins = &tile_bins[chunk * num_tiles];
+    for(int tile = 0; tile < num_tiles; ++tile) {
+        array_reset(bins[tile]);
+    }
+
+    for(int i = first; i < last; ++i) {
+        vec4_t* points = raster->triangles[i].points;
+
+        float min_x = fmin(points[0].x, fmin(points[1].x, points[2].x)) - TILE_BIN_MARGIN;
+        float min_y = fmin(points[0].y, fmin(points[1].y, points[2].y)) - TILE_BIN_MARGIN;
+        float max_x = fmax(points[0].x, fmax(points[1].x, points[2].x)) + TILE_BIN_MARGIN;
+        float max_y = fmax(points[0].y, fmax(points[1].y, points[2].y)) + TILE_BIN_MARGIN;
+
+        // clamping in float first; vertices far off screen don't fit in an int
+        if(max_x < 0 || max_y < 0 || min_x >= window_width || min_y >= window_height) continue;
+        int first_tile_x = (min_x < 0) ? 0 : (int)min_x / TILE_SIZE;
+        int first_tile_y = (min_y < 0) ? 0 : (int)min_y / TILE_SIZE;
+        int last_tile_x = (max_x >= window_width) ? num_tiles_x - 1 : (int)max_x / TILE_SIZE;
+        int last_tile_y = (max_y >= window_height) ? num_tiles_y - 1 : (int)max_y / TILE_SIZE;
+
+        for(int tile_y = first_tile_y; tile_y <= last_tile_y; ++tile_y) {
+            for(int tile_x = first_tile_x; tile_x <= last_tile_x; ++tile_x) {
+                array_push(bins[(tile_y * num_tiles_x) + tile_x], i);
+            }
+        }
+    }
+}
+
+// the filled and textured triangles are depth tested, and the lines of RENDER_WIRE all
+// have the same color, so those methods give the same image for any triangle order.
+// the vertex markers and the wireframes drawn over filled triangles aren't depth tested
+bool raster_needs_painter_order(void) {
+    return render_method == RENDER_WIRE_VERTEX || render_method == RENDER_FILL_TRIANGLE_WIRE || render_method == RENDER_TEXTURED_WIRE;
+}
+
+// drawing one triangle with the current render method, clipped to the thread's clip rect
+static void draw_triangle_to_render(triangle_t* triangle, uint64_t* stage_ns) {
+    uint64_t stage_start;
+
+    if(render_method == RENDER_WIRE_VERTEX){
+        stage_start = profile_start();
+        // drawing vectex points
+        draw_rect(triangle->points[0].x - 3, triangle->points[0].y - 3, 6, 6, 0xFFFF00FF);
+        draw_rect(triangle->points[1].x - 3, triangle->points[1].y - 3, 6, 6, 0xFFFF00FF);
+        draw_rect(triangle->points[2].x - 3, triangle->points[2].y - 3, 6, 6, 0xFFFF00FF);
+        stage_ns[PROFILE_RASTER_VERTICES] += profile_elapsed(stage_start);
+    }
+
+    if(render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE){
+        stage_start = profile_start();
+        // drawing filled triangle
+        draw_filled_triangle(
+            triangle->points[0].x, 
+            triangle->points[0].y,
+            triangle->points[0].w,
+            triangle->points[1].x,
+            triangle->points[1].y,
+            triangle->points[1].w,
+            triangle->points[2].x,
+            triangle->points[2].y,
+            triangle->points[2].w,
+            triangle->color
+        );
+        stage_ns[PROFILE_RASTER_FILL] += profile_elapsed(stage_start);
+    }
+
+    if(render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE){
+        stage_start = profile_start();
+        // drawing textured triangle
+        draw_textured_triangle(
+            triangle->points[0].x, 
+            triangle->points[0].y,
+            triangle->points[0].w,
+            triangle->tex_coords[0].u,
+            triangle->tex_coords[0].v,
+            triangle->points[1].x,
+            triangle->points[1].y,
+            triangle->points[1].w,
+            triangle->tex_coords[1].u,
+            triangle->tex_coords[1].v,
+            triangle->points[2].x,
+            triangle->points[2].y,
+            triangle->points[2].w,
+            triangle->tex_coords[2].u,
+            triangle->tex_coords[2].v,
+            triangle->texture
+        );
+        stage_ns[PROFILE_RASTER_TEXTURED] += profile_elapsed(stage_start);
+    }
+
+    if(render_method == RENDER_WIRE || render_method == RENDER_WIRE_VERTEX || render_method == RENDER_FILL_TRIANGLE_WIRE || render_method == RENDER_TEXTURED_WIRE){
+        stage_start = profile_start();
+        // drawing triangle lines
+        draw_triangle(
+            triangle->points[0].x, 
+            triangle->points[0].y,
+            triangle->points[1].x,
+            triangle->points[1].y,
+            triangle->points[2].x,
+            triangle->points[2].y,
+            0xFFFFFFFF
+        );
+        stage_ns[PROFILE_RASTER_WIRE] += profile_elapsed(stage_start);
+    }
+}
+
+// clearing one tile and drawing everything that overlaps it; no other thread
+// touches this part of the buffers, so there's no locking or atomics
+static void rasterize_tile(void* context, int tile, int thread) {
+    raster_context_t* raster = (raster_context_t*)context;
+    uint64_t stage_ns[NUM_PROFILE_STAGES] = { 0 };
+
+    rect_t rect = get_tile_rect(tile);
+    set_clip_rect(rect);
+
+    uint64_t stage_start = profile_start();
+    clear_color_buffer_rect(rect, 0xFF000000);
+    stage_ns[PROFILE_CLEAR_COLOR_BUFFER] += profile_elapsed(stage_start);
+
+    stage_start = profile_start();
+    clear_z_buffer_rect(rect);
+    stage_ns[PROFILE_CLEAR_Z_BUFFER] += profile_elapsed(stage_start);
+
+    stage_start = profile_start();
+    draw_grid_rect(rect);
+    stage_ns[PROFILE_DRAW_GRID] += profile_elapsed(stage_start);
+
+    for(int chunk = 0; chunk < num_bin_chunks; ++chunk) {
+        int* bin = tile_bins[(chunk * num_tiles) + tile];
+        int bin_length = array_length(bin);
+
+        for(int i = 0; i < bin_length; ++i) {
+            draw_triangle_to_render(&raster->triangles[bin[i]], stage_ns);
+        }
+    }
+
+    if(profile_enabled) {
+        for(int stage = 0; stage < NUM_PROFILE_STAGES; ++stage) {
+            if(stage_ns[stage] != 0) profile_add(stage, stage_ns[stage]);
+        }
+    }
+}
+
+// clearing the buffers and drawing the triangles (in order) into them, one tile per job
+void rasterize_triangles(triangle_t* triangles, int num_of_triangles) {
+    raster_context_t raster = {
+        .triangles = triangles,
+        .num_of_triangles = num_of_triangles
+    };
+
+    uint64_t stage_start = profile_start();
+    thread_pool_run(bin_triangle_chunk, &raster, num_bin_chunks);
+    profile_stop(PROFILE_BIN_TRIANGLES, stage_start);
+
+    thread_pool_run(rasterize_tile, &raster, num_tiles);
+
+    // the calling thread drew tiles too; giving it back the whole window
+    set_clip_rect((rect_t){ 0, 0, window_width, window_height });
+}
+
+void raster_free(void) {
+    for(int i = 0; i < num_bin_chunks * num_tiles; ++i) {
+        array_free(tile_bins[i]);
+    }
+    free(tile_bins);
+    tile_bins = NULL;
+}
@@ -0,0 +1,372 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headers/simplify.h"
+#include "headers/array.h"
+
+// a collapse can't turn any face around it by more than about 80 degrees (no fold-overs)
+#define MIN_COLLAPSE_NORMAL_DOT 0.2
+
+// the squared distances to a set of planes, weighted by the areas of the faces they come
+// from (Garland and Heckbert, "Surface simplification using quadric error metrics", 1997):
+// error(p) = p.A.p + 2 b.p + c, with A symmetric
+typedef struct {
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+} quadric_t;
+
+typedef struct {
+    int from;
+    int to;
+    double cost;
+} collapse_t;
+
+// the faces around each vertex: faces[offsets[v] ..] up to the next offset
+typedef struct {
+    int* offsets;
+    int* faces;
+} adjacency_t;
+
+typedef struct {
+    vec3_t position;
+    int vertex;
+} sorted_vertex_t;
+
+static quadric_t quadric_from_face(vec3_t p0, vec3_t p1, vec3_t p2) {
+    quadric_t q = { 0 };
+    vec3_t normal = vec3_cross(vec3_sub(p1, p0), vec3_sub(p2, p0));
+    double length = vec3_length(normal);
+    if(!(length > 0)) return q;
+
+    double a = normal.x / length;
+    double b = normal.y / length;
+    double c = normal.z / length;
+    double d = -(a * p0.x + b * p0.y + c * p0.z);
+    double weight = length * 0.5; // the area of the face
+
+    q.a00 = weight * a * a; q.a01 = weight * a * b; q.a02 = weight * a * c;
+    q.a11 = weight * b * b; q.a12 = weight * b * c; q.a22 = weight * c * c;
+    q.b0 = weight * a * d; q.b1 = weight * b * d; q.b2 = weight * c * d;
+    q.c = weight * d * d;
+    q.weight = weight;
+    return q;
+}
+
+static void quadric_add(quadric_t* q, quadric_t* other) {
+    q->a00 += other->a00; q->a01 += other->a01; q->a02 += other->a02;
+    q->a11 += other->a11; q->a12 += other->a12; q->a22 += other->a22;
+    q->b0 += other->b0; q->b1 += other->b1; q->b2 += other->b2;
+    q->c += other->c;
+    q->weight += other->weight;
+}
+
+// the mean squared distance from p to the planes
+static double quadric_error(quadric_t* q, vec3_t p) {
+    if(!(q->weight > 0)) return 0;
+
+    double x = p.x, y = p.y, z = p.z;
+    double error =
+        q->a00 * x * x + q->a11 * y * y + q->a22 * z * z +
+        2 * (q->a01 * x * y + q->a02 * x * z + q->a12 * y * z) +
+        2 * (q->b0 * x + q->b1 * y + q->b2 * z) +
+        q->c;
+    return fabs(error) / q->weight;
+}
+
+static bool is_same_position(vec3_t a, vec3_t b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static int compare_positions(const void* a, const void* b) {
+    const sorted_vertex_t* va = (const sorted_vertex_t*)a;
+    const sorted_vertex_t* vb = (const sorted_vertex_t*)b;
+    if(va->position.x != vb->position.x) return va->position.x < vb->position.x ? -1 : 1;
+    if(va->position.y != vb->position.y) return va->position.y < vb->position.y ? -1 : 1;
+    if(va->position.z != vb->position.z) return va->position.z < vb->position.z ? -1 : 1;
+    return va->vertex - vb->vertex;
+}
+
+static int compare_collapses(const void* a, const void* b) {
+    const collapse_t* ca = (const collapse_t*)a;
+    const collapse_t* cb = (const collapse_t*)b;
+    if(ca->cost != cb->cost) return ca->cost < cb->cost ? -1 : 1;
+    return ca->from - cb->from;
+}
+
+static void build_adjacency(adjacency_t* adjacency, face_t* faces, int num_faces, int num_vertices) {
+    memset(adjacency->offsets, 0, sizeof(int) * (num_vertices + 1));
+    for(int i = 0; i < num_faces; ++i){
+        ++adjacency->offsets[faces[i].a + 1];
+        ++adjacency->offsets[faces[i].b + 1];
+        ++adjacency->offsets[faces[i].c + 1];
+    }
+    for(int v = 0; v < num_vertices; ++v){
+        adjacency->offsets[v + 1] += adjacency->offsets[v];
+    }
+    for(int i = 0; i < num_faces; ++i){
+        adjacency->faces[adjacency->offsets[faces[i].a]++] = i;
+        adjacency->faces[adjacency->offsets[faces[i].b]++] = i;
+        adjacency->faces[adjacency->offsets[faces[i].c]++] = i;
+    }
+    // filling moved every offset up to where the next vertex starts; moving them back
+    for(int v = num_vertices; v > 0; --v){
+        adjacency->offsets[v] = adjacency->offsets[v - 1];
+    }
+    adjacency->offsets[0] = 0;
+}
+
+// the corner of the face after (k = 1) or before (k = 2) the vertex
+static int face_corner_from(face_t* face, int vertex, int k) {
+    int corners[3] = { face->a, face->b, face->c };
+    int i = (corners[0] == vertex) ? 0 : (corners[1] == vertex) ? 1 : 2;
+    return corners[(i + k) % 3];
+}
+
+// the mesh being simplified. vertices sharing a position (the sides of a uv seam) make a
+// group, named after its first vertex, which moves as one
+typedef struct {
+    vec3_t* vertices;
+    face_t* faces;          // the faces left
+    int num_faces;
+    adjacency_t adjacency;
+    int* group;             // the group of each vertex
+    int* next_in_group;     // the next vertex of the same group; -1 after the last
+    bool* is_locked;        // per group: on an open border, so it stays put
+    quadric_t* quadrics;    // per group
+} simplifier_t;
+
+static bool face_has_group(simplifier_t* s, face_t* face, int group) {
+    return s->group[face->a] == group || s->group[face->b] == group || s->group[face->c] == group;
+}
+
+// groups on an open border, or on an edge shared by other than two faces the same way
+// round, have an edge to a group that's the next corner in some face around them more
+// often than the previous corner in another. uv seams aren't borders: the faces on the
+// two sides use different vertices, but of the same groups
+static void lock_border_groups(simplifier_t* s, int num_vertices) {
+    for(int g = 0; g < num_vertices; ++g){
+        if(s->group[g] != g) continue;
+
+        for(int u = g; u != -1 && !s->is_locked[g]; u = s->next_in_group[u]){
+            for(int j = s->adjacency.offsets[u]; j < s->adjacency.offsets[u + 1]; ++j){
+                int next = s->group[face_corner_from(&s->faces[s->adjacency.faces[j]], u, 1)];
+
+                int balance = 0;
+                for(int w = g; w != -1; w = s->next_in_group[w]){
+                    for(int i = s->adjacency.offsets[w]; i < s->adjacency.offsets[w + 1]; ++i){
+                        face_t* face = &s->faces[s->adjacency.faces[i]];
+                        if(s->group[face_corner_from(face, w, 1)] == next) ++balance;
+                        if(s->group[face_corner_from(face, w, 2)] == next) --balance;
+                    }
+                }
+                if(balance != 0){
+                    s->is_locked[g] = true;
+                    s->is_locked[next] = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// the vertex of the group sharing a face with `vertex`; -1 when there's none
+static int find_neighbour_in_group(simplifier_t* s, int vertex, int group) {
+    for(int j = s->adjacency.offsets[vertex]; j < s->adjacency.offsets[vertex + 1]; ++j){
+        face_t* face = &s->faces[s->adjacency.faces[j]];
+        for(int k = 1; k <= 2; ++k){
+            int corner = face_corner_from(face, vertex, k);
+            if(s->group[corner] == group) return corner;
+        }
+    }
+    return -1;
+}
+
+// whether group `from` can move onto group `to`: every vertex of it needs a neighbour in
+// `to` to move onto (so on a seam, the uvs on both sides slide along it), and every face
+// around it that doesn't collapse has to keep facing about the same way
+static bool can_collapse(simplifier_t* s, int from, int to) {
+    vec3_t moved = s->vertices[to];
+
+    for(int u = from; u != -1; u = s->next_in_group[u]){
+        if(find_neighbour_in_group(s, u, to) == -1) return false;
+
+        for(int j = s->adjacency.offsets[u]; j < s->adjacency.offsets[u + 1]; ++j){
+            face_t* face = &s->faces[s->adjacency.faces[j]];
+            if(face_has_group(s, face, to)) continue;
+
+            vec3_t p0 = s->vertices[u];
+            vec3_t p1 = s->vertices[face_corner_from(face, u, 1)];
+            vec3_t p2 = s->vertices[face_corner_from(face, u, 2)];
+            vec3_t normal = vec3_cross(vec3_sub(p1, p0), vec3_sub(p2, p0));
+            vec3_t moved_normal = vec3_cross(vec3_sub(p1, moved), vec3_sub(p2, moved));
+
+            float length = vec3_length(normal);
+            if(!(length > 0)) continue;
+            if(!(vec3_dot(normal, moved_normal) > MIN_COLLAPSE_NORMAL_DOT * length * vec3_length(moved_normal))) return false;
+        }
+    }
+    return true;
+}
+
+static void add_level(simplified_level_t* level, face_t* faces, int num_faces, double max_cost) {
+    level->faces = NULL;
+    if(num_faces > 0){
+        level->faces = array_hold(NULL, num_faces, sizeof(face_t));
+        memcpy(level->faces, faces, sizeof(face_t) * num_faces);
+    }
+    level->error = (float)sqrt(max_cost);
+}
+
+// the collapses run in passes: every group that may move picks the cheapest neighbouring
+// group to move onto (a half edge collapse, so vertices keep their positions and uvs),
+// then the cheapest picks are made as long as they don't touch the faces of an earlier one
+// in the same pass. a level is taken whenever the faces get down to its share of the
+// level before
+int simplify_mesh(vec3_t* vertices, int num_vertices, face_t* faces, int num_faces, simplified_level_t* levels, int max_levels) {
+    if(num_faces == 0 || num_vertices == 0 || max_levels == 0) return 0;
+
+    simplifier_t s = {
+        .vertices = vertices,
+        .faces = (face_t*)malloc(sizeof(face_t) * num_faces),
+        .num_faces = 0,
+        .adjacency = {
+            .offsets = (int*)malloc(sizeof(int) * (num_vertices + 1)),
+            .faces = (int*)malloc(sizeof(int) * num_faces * 3)
+        },
+        .group = (int*)malloc(sizeof(int) * num_vertices),
+        .next_in_group = (int*)malloc(sizeof(int) * num_vertices),
+        .is_locked = (bool*)calloc(num_vertices, sizeof(bool)),
+        .quadrics = (quadric_t*)calloc(num_vertices, sizeof(quadric_t))
+    };
+
+    // the groups are the runs of equal positions among the sorted vertices
+    sorted_vertex_t* sorted = (sorted_vertex_t*)malloc(sizeof(sorted_vertex_t) * num_vertices);
+    for(int v = 0; v < num_vertices; ++v){
+        sorted[v] = (sorted_vertex_t){ vertices[v], v };
+    }
+    qsort(sorted, num_vertices, sizeof(sorted_vertex_t), compare_positions);
+    for(int i = 0; i < num_vertices; ++i){
+        int v = sorted[i].vertex;
+        bool is_same = i > 0 && is_same_position(sorted[i].position, sorted[i - 1].position);
+        s.group[v] = is_same ? s.group[sorted[i - 1].vertex] : v;
+        s.next_in_group[v] = -1;
+        if(is_same) s.next_in_group[sorted[i - 1].vertex] = v;
+    }
+    free(sorted);
+
+    // the faces being simplified, without the ones that have no area to begin with
+    for(int i = 0; i < num_faces; ++i){
+        int a = s.group[faces[i].a], b = s.group[faces[i].b], c = s.group[faces[i].c];
+        if(a != b && b != c && a != c) s.faces[s.num_faces++] = faces[i];
+    }
+
+    for(int i = 0; i < s.num_faces; ++i){
+        quadric_t q = quadric_from_face(vertices[s.faces[i].a], vertices[s.faces[i].b], vertices[s.faces[i].c]);
+        quadric_add(&s.quadrics[s.group[s.faces[i].a]], &q);
+        quadric_add(&s.quadrics[s.group[s.faces[i].b]], &q);
+        quadric_add(&s.quadrics[s.group[s.faces[i].c]], &q);
+    }
+
+    build_adjacency(&s.adjacency, s.faces, s.num_faces, num_vertices);
+    lock_border_groups(&s, num_vertices);
+
+    int* remap = (int*)malloc(sizeof(int) * num_vertices);
+    for(int v = 0; v < num_vertices; ++v){
+        remap[v] = v;
+    }
+    bool* is_touched = (bool*)malloc(sizeof(bool) * num_vertices);
+    collapse_t* collapses = (collapse_t*)malloc(sizeof(collapse_t) * num_vertices);
+
+    int num_levels = 0;
+    int level_faces = num_faces;
+    int target_faces = (int)(level_faces * SIMPLIFY_LEVEL_RATIO);
+    double max_cost = 0;
+
+    while(num_levels < max_levels && level_faces > SIMPLIFY_MIN_FACES){
+        // the cheapest collapse of every group that can move
+        int num_collapses = 0;
+        for(int g = 0; g < num_vertices; ++g){
+            if(s.group[g] != g || s.is_locked[g]) continue;
+
+            collapse_t best = { g, -1, INFINITY };
+            for(int u = g; u != -1; u = s.next_in_group[u]){
+                for(int j = s.adjacency.offsets[u]; j < s.adjacency.offsets[u + 1]; ++j){
+                    face_t* face = &s.faces[s.adjacency.faces[j]];
+                    for(int k = 1; k <= 2; ++k){
+                        int to = s.group[face_corner_from(face, u, k)];
+                        if(to == best.to) continue;
+
+                        double cost = quadric_error(&s.quadrics[g], vertices[to]);
+                        if(cost >= best.cost || !can_collapse(&s, g, to)) continue;
+                        best.to = to;
+                        best.cost = cost;
+                    }
+                }
+            }
+            if(best.to != -1) collapses[num_collapses++] = best;
+        }
+        if(num_collapses == 0) break;
+        qsort(collapses, num_collapses, sizeof(collapse_t), compare_collapses);
+
+        memset(is_touched, 0, sizeof(bool) * num_vertices);
+        int faces_left = s.num_faces;
+        int num_collapsed = 0;
+        for(int i = 0; i < num_collapses && faces_left > target_faces; ++i){
+            collapse_t* collapse = &collapses[i];
+            if(is_touched[collapse->from] || is_touched[collapse->to]) continue;
+
+            for(int u = collapse->from; u != -1; u = s.next_in_group[u]){
+                remap[u] = find_neighbour_in_group(&s, u, collapse->to);
+
+                for(int j = s.adjacency.offsets[u]; j < s.adjacency.offsets[u + 1]; ++j){
+                    face_t* face = &s.faces[s.adjacency.faces[j]];
+                    if(face_has_group(&s, face, collapse->to)) --faces_left;
+                    is_touched[s.group[face->a]] = is_touched[s.group[face->b]] = is_touched[s.group[face->c]] = true;
+                }
+            }
+            quadric_add(&s.quadrics[collapse->to], &s.quadrics[collapse->from]);
+            if(collapse->cost > max_cost) max_cost = collapse->cost;
+            ++num_collapsed;
+        }
+        if(num_collapsed == 0) break;
+
+        // moving the collapsed vertices and dropping the faces left without area
+        int num_kept = 0;
+        for(int i = 0; i < s.num_faces; ++i){
+            face_t face = s.faces[i];
+            face.a = remap[face.a];
+            face.b = remap[face.b];
+            face.c = remap[face.c];
+            int a = s.group[face.a], b = s.group[face.b], c = s.group[face.c];
+            if(a != b && b != c && a != c) s.faces[num_kept++] = face;
+        }
+        s.num_faces = num_kept;
+        build_adjacency(&s.adjacency, s.faces, s.num_faces, num_vertices);
+
+        if(s.num_faces <= target_faces){
+            add_level(&levels[num_levels++], s.faces, s.num_faces, max_cost);
+            level_faces = s.num_faces;
+            target_faces = (int)(level_faces * SIMPLIFY_LEVEL_RATIO);
+        }
+    }
+
+    // whatever the last passes got to, when it's worth a level of its own
+    if(num_levels < max_levels && s.num_faces <= level_faces * (1 - SIMPLIFY_MIN_REDUCTION)){
+        add_level(&levels[num_levels++], s.faces, s.num_faces, max_cost);
+    }
+
+    free(collapses);
+    free(is_touched);
+    free(remap);
+    free(s.quadrics);
+    free(s.is_locked);
+    free(s.next_in_group);
+    free(s.group);
+    free(s.adjacency.faces);
+    free(s.adjacency.offsets);
+    free(s.faces);
+    return num_levels;
+}
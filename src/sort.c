@@ -1,35 +1,153 @@
-#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "headers/sort.h"
 #include "headers/triangle.h"
+#include "headers/thread_pool.h"
 
-void quick_sort(triangle_t triangles_to_render[], int low, int high) {
-    if (low < high) {
-        int pivot_index = partition(triangles_to_render, low, high);
-        quick_sort(triangles_to_render, low, pivot_index - 1);
-        quick_sort(triangles_to_render, pivot_index + 1, high);
+// the triangles are sorted with an LSD radix sort on 32-bit keys made from their average
+// depth, one byte per pass. every pass is a stable counting sort, so triangles with the
+// same depth stay in face order, and the cost is the same for any input (no worst case)
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (32 / RADIX_BITS)
+
+// below this many triangles the keys and histograms are built on one thread
+#define MIN_PARALLEL_SORT_SIZE 16384
+
+// the passes move (key, index) pairs around instead of the triangles themselves
+typedef struct {
+    uint32_t key;
+    int index;
+} sort_key_t;
+
+typedef int histogram_t[RADIX_PASSES][RADIX_BUCKETS];
+
+static sort_key_t* keys = NULL;
+static sort_key_t* keys_scratch = NULL;
+static triangle_t* sorted_triangles = NULL;
+static int sort_capacity = 0;
+
+// the histograms of every pass, for each chunk of triangles
+static histogram_t* chunk_histograms = NULL;
+static int num_histogram_chunks = 0;
+
+typedef struct {
+    triangle_t* triangles;
+    int num_of_triangles;
+    int num_of_chunks;
+} sort_context_t;
+
+// a key that orders the depths from the largest (farthest) to the smallest
+static uint32_t depth_key(float depth) {
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+
+    // flipping the sign bit of positive floats and every bit of negative ones gives
+    // keys in ascending order of the floats; inverting those makes them descending
+    bits ^= (bits & 0x80000000) ? 0xFFFFFFFF : 0x80000000;
+    return ~bits;
+}
+
+// building the keys of a range of triangles and counting the digits of all passes
+static void build_key_chunk(void* context, int chunk, int thread) {
+    sort_context_t* sort = (sort_context_t*)context;
+
+    int first = (int)((long long)sort->num_of_triangles * chunk / sort->num_of_chunks);
+    int last = (int)((long long)sort->num_of_triangles * (chunk + 1) / sort->num_of_chunks);
+
+    int (*histogram)[RADIX_BUCKETS] = chunk_histograms[chunk];
+    memset(histogram, 0, sizeof(histogram_t));
+
+    for(int i = first; i < last; ++i){
+        uint32_t key = depth_key(sort->triangles[i].avg_depth);
+        keys[i].key = key;
+        keys[i].index = i;
+
+        for(int pass = 0; pass < RADIX_PASSES; ++pass){
+            histogram[pass][(key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+        }
     }
 }
 
-int partition(triangle_t triangles_to_render[], int low, int high) {
-    float pivot = triangles_to_render[high].avg_depth;
-    int i = low - 1;
+void sort_triangles(triangle_t triangles_to_render[], int num_of_triangles) {
+    if(num_of_triangles < 2) return;
+
+    if(num_of_triangles > sort_capacity){
+        keys = (sort_key_t*)realloc(keys, sizeof(sort_key_t) * num_of_triangles);
+        keys_scratch = (sort_key_t*)realloc(keys_scratch, sizeof(sort_key_t) * num_of_triangles);
+        sorted_triangles = (triangle_t*)realloc(sorted_triangles, sizeof(triangle_t) * num_of_triangles);
+        sort_capacity = num_of_triangles;
+    }
+
+    sort_context_t sort = {
+        .triangles = triangles_to_render,
+        .num_of_triangles = num_of_triangles,
+        .num_of_chunks = (num_of_triangles >= MIN_PARALLEL_SORT_SIZE) ? thread_pool_size() : 1
+    };
+
+    if(sort.num_of_chunks > num_histogram_chunks){
+        chunk_histograms = (histogram_t*)realloc(chunk_histograms, sizeof(histogram_t) * sort.num_of_chunks);
+        num_histogram_chunks = sort.num_of_chunks;
+    }
+
+    thread_pool_run(build_key_chunk, &sort, sort.num_of_chunks);
 
-    for (int j = low; j < high; j++) {
-        if (triangles_to_render[j].avg_depth > pivot) {
-            i++;
-            triangle_t temp = triangles_to_render[i];
-            triangles_to_render[i] = triangles_to_render[j];
-            triangles_to_render[j] = temp;
+    histogram_t histogram;
+    memcpy(histogram, chunk_histograms[0], sizeof(histogram_t));
+    for(int chunk = 1; chunk < sort.num_of_chunks; ++chunk){
+        for(int pass = 0; pass < RADIX_PASSES; ++pass){
+            for(int bucket = 0; bucket < RADIX_BUCKETS; ++bucket){
+                histogram[pass][bucket] += chunk_histograms[chunk][pass][bucket];
+            }
         }
     }
 
-    triangle_t temp = triangles_to_render[i + 1];
-    triangles_to_render[i + 1] = triangles_to_render[high];
-    triangles_to_render[high] = temp;
+    sort_key_t* source = keys;
+    sort_key_t* destination = keys_scratch;
+
+    for(int pass = 0; pass < RADIX_PASSES; ++pass){
+        int shift = pass * RADIX_BITS;
+        int* offsets = histogram[pass];
+
+        // when every key has the same digit the pass wouldn't move anything
+        // (e.g. the sign and exponent byte of depths in a narrow range)
+        if(offsets[(source[0].key >> shift) & (RADIX_BUCKETS - 1)] == num_of_triangles) continue;
 
-    return i + 1;
+        // turning the counts into the first position of each bucket
+        int offset = 0;
+        for(int bucket = 0; bucket < RADIX_BUCKETS; ++bucket){
+            int count = offsets[bucket];
+            offsets[bucket] = offset;
+            offset += count;
+        }
+
+        for(int i = 0; i < num_of_triangles; ++i){
+            int bucket = (source[i].key >> shift) & (RADIX_BUCKETS - 1);
+            destination[offsets[bucket]++] = source[i];
+        }
+
+        sort_key_t* swap = source;
+        source = destination;
+        destination = swap;
+    }
+
+    // moving the triangles themselves only once, in sorted order
+    for(int i = 0; i < num_of_triangles; ++i){
+        sorted_triangles[i] = triangles_to_render[source[i].index];
+    }
+    memcpy(triangles_to_render, sorted_triangles, sizeof(triangle_t) * num_of_triangles);
 }
 
-void sort_triangles(triangle_t triangles_to_render[], int num_of_triangles) {
-    quick_sort(triangles_to_render, 0, num_of_triangles - 1);
+void sort_free(void) {
+    free(keys);
+    free(keys_scratch);
+    free(sorted_triangles);
+    free(chunk_histograms);
+    keys = NULL;
+    keys_scratch = NULL;
+    sorted_triangles = NULL;
+    chunk_histograms = NULL;
+    sort_capacity = 0;
+    num_histogram_chunks = 0;
 }
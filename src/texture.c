@@ -1,21 +1,467 @@
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headers/array.h"
 #include "headers/texture.h"
+#include "headers/texture_cache.h"
+#include "headers/upng.h"
 
-int texture_width = 64;
-int texture_height = 64;
+// the color of the single texel a texture shows before anything better is resident
+#define PLACEHOLDER_COLOR 0xFF808080
 
-upng_t* png_texture = NULL;
-uint32_t* mesh_texture = NULL;
+// a png for the streaming thread to decode into the levels from 'first' on of a texture
+typedef struct texture_stream {
+    texture_t* texture;
+    upng_t* png; // already read by acquire_texture(), or NULL to read the file again
+    int first;
+    bool save_cache; // writing the texture cache once it's decoded
+    uint32_t* texels[TEXTURE_MAX_LEVELS]; // the decoded levels; NULL when decoding failed
+    struct texture_stream* next;
+} texture_stream_t;
 
-void load_png_texture_data(char* filename) {
-    png_texture = upng_new_from_file(filename);
+// every texture loaded from a png so far, referenced or not; an evicted one keeps its
+// entry, so acquiring it again only has to decode its levels
+static texture_t** textures = NULL;
+// shared by every mesh whose png can't be read; never evicted
+static texture_t default_texture = { .num_levels = 0 };
 
-    if(png_texture != NULL) {
-        upng_decode(png_texture);
-        if(upng_get_error(png_texture) == UPNG_EOK) {
-            mesh_texture = (uint32_t*)upng_get_buffer(png_texture);
-            texture_width = upng_get_width(png_texture);
-            texture_height = upng_get_height(png_texture);
+static size_t texture_budget = 0;
+static size_t resident_bytes = 0;
+static int residency_frame = 0;
+
+// the streaming thread is started with the first png and decodes one at a time, in the
+// order they were asked for; the main thread swaps the finished ones in between frames
+static pthread_t stream_thread;
+static bool is_stream_thread_started = false;
+static bool is_stream_thread_quitting = false;
+static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_requested = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t stream_finished = PTHREAD_COND_INITIALIZER;
+static texture_stream_t* pending_streams = NULL;     // first in, first out
+static texture_stream_t* last_pending_stream = NULL;
+static texture_stream_t* finished_streams = NULL;
+static int num_decoding_streams = 0;
+
+// setting the sizes of the mip chain of a width x height texture, with none of its
+// levels resident yet
+static void set_texture_levels(texture_t* texture, int width, int height) {
+    texture->num_levels = 0;
+    while(texture->num_levels < TEXTURE_MAX_LEVELS) {
+        texture_level_t* level = &texture->levels[texture->num_levels++];
+        level->texels = NULL;
+        level->width = width;
+        level->height = height;
+        level->tile_row_stride = ((width + 3) / 4) * 16;
+        level->last_used = residency_frame;
+
+        if(width == 1 && height == 1) break;
+        width = (width > 1) ? width / 2 : 1;
+        height = (height > 1) ? height / 2 : 1;
+    }
+    texture->first_level = texture->num_levels;
+    texture->used_levels = 0;
+    texture->bytes = 0;
+}
+
+// adding the levels from 'first' up to the resident ones to the resident bytes
+static void add_resident_levels(texture_t* texture, int first) {
+    for(int i = first; i < texture->first_level; ++i) {
+        texture->levels[i].last_used = residency_frame;
+        texture->bytes += get_texture_level_bytes(&texture->levels[i]);
+        resident_bytes += get_texture_level_bytes(&texture->levels[i]);
+    }
+    texture->first_level = first;
+}
+
+// averaging 2x2 texels of 'source' into every texel of 'level', channel by channel; the
+// last row or column of an odd sized source is folded into the texels next to it
+static void downsample_texture_level(const texture_level_t* source, texture_level_t* level) {
+    for(int y = 0; y < level->height; ++y) {
+        int y0 = y * 2;
+        int y1 = (y0 + 1 < source->height) ? y0 + 1 : y0;
+        for(int x = 0; x < level->width; ++x) {
+            int x0 = x * 2;
+            int x1 = (x0 + 1 < source->width) ? x0 + 1 : x0;
+            uint32_t texels[4] = {
+                source->texels[texel_offset(source, x0, y0)],
+                source->texels[texel_offset(source, x1, y0)],
+                source->texels[texel_offset(source, x0, y1)],
+                source->texels[texel_offset(source, x1, y1)]
+            };
+
+            uint32_t color = 0;
+            for(int shift = 0; shift < 32; shift += 8) {
+                uint32_t sum = 2; // rounding to nearest
+                for(int i = 0; i < 4; ++i) sum += (texels[i] >> shift) & 0xFF;
+                color |= (sum / 4) << shift;
+            }
+            level->texels[texel_offset(level, x, y)] = color;
+        }
+    }
+}
+
+// allocating every level of a mip chain and building them from the rows of level 0;
+// false (with nothing allocated) if the memory runs out
+static bool build_texture_levels(texture_level_t* levels, int num_levels, const uint32_t* rows) {
+    for(int i = 0; i < num_levels; ++i) {
+        levels[i].texels = (uint32_t*)malloc(get_texture_level_bytes(&levels[i]));
+        if(levels[i].texels == NULL) {
+            for(int j = 0; j < i; ++j) {
+                free(levels[j].texels);
+                levels[j].texels = NULL;
+            }
+            fprintf(stderr, "Error: Could not allocate a %dx%d texture\n", levels[0].width, levels[0].height);
+            return false;
+        }
+    }
+
+    for(int y = 0; y < levels[0].height; ++y) {
+        for(int x = 0; x < levels[0].width; ++x) {
+            levels[0].texels[texel_offset(&levels[0], x, y)] = rows[(levels[0].width * y) + x];
+        }
+    }
+    for(int i = 1; i < num_levels; ++i) {
+        downsample_texture_level(&levels[i - 1], &levels[i]);
+    }
+    return true;
+}
+
+// decoding a png on the streaming thread; the texture's level sizes never change, so
+// they're safe to read while the main thread renders with it
+static void decode_texture_stream(texture_stream_t* stream) {
+    texture_t* texture = stream->texture;
+    upng_t* png = (stream->png != NULL) ? stream->png : upng_new_from_file(texture->filename);
+    stream->png = NULL;
+
+    texture_level_t levels[TEXTURE_MAX_LEVELS];
+    for(int i = 0; i < texture->num_levels; ++i) {
+        levels[i] = (texture_level_t){
+            .width = texture->levels[i].width,
+            .height = texture->levels[i].height,
+            .tile_row_stride = texture->levels[i].tile_row_stride
+        };
+    }
+
+    bool is_decoded =
+        png != NULL &&
+        upng_decode(png) == UPNG_EOK &&
+        (int)upng_get_width(png) == levels[0].width &&
+        (int)upng_get_height(png) == levels[0].height &&
+        upng_get_format(png) == UPNG_RGBA8;
+    if(!is_decoded) {
+        fprintf(stderr, "Error: Could not decode the texture %s, keeping its resident levels\n", texture->filename);
+    } else if(build_texture_levels(levels, texture->num_levels, (const uint32_t*)upng_get_buffer(png))) {
+        if(stream->save_cache) save_texture_cache(levels, texture->num_levels, texture->filename);
+        for(int i = 0; i < texture->num_levels; ++i) {
+            if(i < stream->first) {
+                free(levels[i].texels);
+            } else {
+                stream->texels[i] = levels[i].texels;
+            }
+        }
+    }
+    if(png != NULL) upng_free(png);
+}
+
+static void* run_stream_thread(void* unused) {
+    (void)unused;
+    pthread_mutex_lock(&stream_mutex);
+    while(true) {
+        while(pending_streams == NULL && !is_stream_thread_quitting) {
+            pthread_cond_wait(&stream_requested, &stream_mutex);
+        }
+        if(is_stream_thread_quitting) break;
+
+        texture_stream_t* stream = pending_streams;
+        pending_streams = stream->next;
+        if(pending_streams == NULL) last_pending_stream = NULL;
+        ++num_decoding_streams;
+        pthread_mutex_unlock(&stream_mutex);
+
+        decode_texture_stream(stream);
+
+        pthread_mutex_lock(&stream_mutex);
+        stream->next = finished_streams;
+        finished_streams = stream;
+        --num_decoding_streams;
+        pthread_cond_broadcast(&stream_finished);
+    }
+    pthread_mutex_unlock(&stream_mutex);
+    return NULL;
+}
+
+// asking the streaming thread for the levels from 'first' on of a texture, decoded from
+// 'png' (or the file when it's NULL); one request per texture at a time
+static void request_texture_stream(texture_t* texture, int first, upng_t* png, bool save_cache) {
+    if(texture->is_streaming) {
+        if(png != NULL) upng_free(png);
+        return;
+    }
+
+    texture_stream_t* stream = (texture_stream_t*)calloc(1, sizeof(texture_stream_t));
+    stream->texture = texture;
+    stream->png = png;
+    stream->first = first;
+    stream->save_cache = save_cache;
+    texture->is_streaming = true;
+
+    pthread_mutex_lock(&stream_mutex);
+    if(!is_stream_thread_started) {
+        is_stream_thread_started = pthread_create(&stream_thread, NULL, run_stream_thread, NULL) == 0;
+    }
+    if(is_stream_thread_started) {
+        if(last_pending_stream != NULL) {
+            last_pending_stream->next = stream;
+        } else {
+            pending_streams = stream;
+        }
+        last_pending_stream = stream;
+        pthread_cond_signal(&stream_requested);
+    }
+    pthread_mutex_unlock(&stream_mutex);
+
+    // without a thread the png is decoded right here, and swapped in with the others
+    if(!is_stream_thread_started) {
+        decode_texture_stream(stream);
+        stream->next = finished_streams;
+        finished_streams = stream;
+    }
+}
+
+// swapping the levels the streaming thread has decoded into their textures; only while
+// nothing renders
+static void install_finished_streams(void) {
+    pthread_mutex_lock(&stream_mutex);
+    texture_stream_t* stream = finished_streams;
+    finished_streams = NULL;
+    pthread_mutex_unlock(&stream_mutex);
+
+    while(stream != NULL) {
+        texture_t* texture = stream->texture;
+        texture->is_streaming = false;
+        if(stream->texels[texture->num_levels - 1] == NULL) {
+            texture->can_reload = false;
+        } else {
+            int first = (stream->first < texture->first_level) ? stream->first : texture->first_level;
+            for(int i = stream->first; i < texture->num_levels; ++i) {
+                free(texture->levels[i].texels);
+                texture->levels[i].texels = stream->texels[i];
+            }
+            resident_bytes -= texture->bytes;
+            texture->bytes = 0;
+            texture->first_level = texture->num_levels;
+            add_resident_levels(texture, first);
+        }
+
+        texture_stream_t* next = stream->next;
+        free(stream);
+        stream = next;
+    }
+}
+
+void finish_texture_streaming(void) {
+    pthread_mutex_lock(&stream_mutex);
+    while(pending_streams != NULL || num_decoding_streams > 0) {
+        pthread_cond_wait(&stream_finished, &stream_mutex);
+    }
+    pthread_mutex_unlock(&stream_mutex);
+    install_finished_streams();
+}
+
+// something to sample until the png is decoded: the coarse levels from the texture cache,
+// or a gray coarsest level; true if they came from the cache
+static bool load_texture_placeholder(texture_t* texture) {
+    if(texture->use_cache && load_texture_cache(texture, texture->filename)) {
+        int first = texture->first_level;
+        texture->first_level = texture->num_levels;
+        add_resident_levels(texture, first);
+        return true;
+    }
+
+    texture_level_t* level = &texture->levels[texture->num_levels - 1];
+    level->texels = (uint32_t*)malloc(get_texture_level_bytes(level));
+    if(level->texels == NULL) return false;
+    for(int i = 0; i < level->tile_row_stride; ++i) level->texels[i] = PLACEHOLDER_COLOR;
+    add_resident_levels(texture, texture->num_levels - 1);
+    return false;
+}
+
+static texture_t* get_default_texture(void) {
+    if(default_texture.num_levels == 0) {
+        static uint32_t rows[DEFAULT_TEXTURE_SIZE * DEFAULT_TEXTURE_SIZE];
+        for(int y = 0; y < DEFAULT_TEXTURE_SIZE; ++y) {
+            for(int x = 0; x < DEFAULT_TEXTURE_SIZE; ++x) {
+                int is_light = ((x / DEFAULT_TEXTURE_SQUARE_SIZE) + (y / DEFAULT_TEXTURE_SQUARE_SIZE)) % 2;
+                rows[(DEFAULT_TEXTURE_SIZE * y) + x] = is_light ? 0xFFFFFFFF : 0xFF808080;
+            }
+        }
+        set_texture_levels(&default_texture, DEFAULT_TEXTURE_SIZE, DEFAULT_TEXTURE_SIZE);
+        if(build_texture_levels(default_texture.levels, default_texture.num_levels, rows)) {
+            add_resident_levels(&default_texture, 0);
+        }
+    }
+    return &default_texture;
+}
+
+texture_t* acquire_texture(char* filename, bool use_cache) {
+    texture_t* texture = NULL;
+    for(int i = 0; i < array_length(textures); ++i) {
+        if(strcmp(textures[i]->filename, filename) == 0) {
+            texture = textures[i];
+            break;
+        }
+    }
+
+    if(texture == NULL) {
+        // only the header is read here; the rest of the png is decoded on the streaming thread
+        upng_t* png = upng_new_from_file(filename);
+        if(png != NULL && upng_header(png) == UPNG_EOK) {
+            texture = (texture_t*)calloc(1, sizeof(texture_t));
+            texture->filename = (char*)malloc(strlen(filename) + 1);
+            strcpy(texture->filename, filename);
+            texture->can_reload = true;
+            texture->use_cache = use_cache;
+            set_texture_levels(texture, upng_get_width(png), upng_get_height(png));
+            bool is_cached = load_texture_placeholder(texture);
+            request_texture_stream(texture, 0, png, use_cache && !is_cached);
+            array_push(textures, texture);
+        } else if(png != NULL) {
+            upng_free(png);
+        }
+    } else if(texture->first_level == texture->num_levels && texture->can_reload) {
+        // evicted entirely while nobody referenced it
+        load_texture_placeholder(texture);
+        request_texture_stream(texture, 0, NULL, false);
+    }
+
+    if(texture == NULL || texture->first_level == texture->num_levels) {
+        fprintf(stderr, "Error: Could not load the texture %s, using the default texture\n", filename);
+        return get_default_texture();
+    }
+    ++texture->references;
+    return texture;
+}
+
+// the texture stays resident without references, until the budget needs its memory
+void release_texture(texture_t* texture) {
+    if(texture != &default_texture) --texture->references;
+}
+
+void set_texture_budget(size_t bytes) {
+    texture_budget = bytes;
+}
+
+size_t get_texture_bytes(void) {
+    return resident_bytes;
+}
+
+// evicting the finest resident level of the texture whose finest resident level was
+// used the longest ago, if that was before 'frame' (ties go to the bigger level); a
+// referenced texture always keeps its coarsest level. false if there's nothing to evict
+static bool evict_texture_level(int frame) {
+    texture_t* victim = NULL;
+    for(int i = 0; i < array_length(textures); ++i) {
+        texture_t* texture = textures[i];
+        int kept_levels = (texture->references > 0) ? 1 : 0;
+        if(texture->num_levels - texture->first_level <= kept_levels) continue;
+
+        texture_level_t* level = &texture->levels[texture->first_level];
+        if(level->last_used >= frame) continue;
+        if(victim != NULL) {
+            texture_level_t* victim_level = &victim->levels[victim->first_level];
+            if(level->last_used > victim_level->last_used) continue;
+            if(level->last_used == victim_level->last_used && get_texture_level_bytes(level) <= get_texture_level_bytes(victim_level)) continue;
         }
+        victim = texture;
+    }
+    if(victim == NULL) return false;
+
+    texture_level_t* level = &victim->levels[victim->first_level++];
+    victim->bytes -= get_texture_level_bytes(level);
+    resident_bytes -= get_texture_level_bytes(level);
+    free(level->texels);
+    level->texels = NULL;
+    return true;
+}
+
+// evicting levels last used before 'frame' until 'bytes' more fit in the budget; false
+// if they don't
+static bool make_texture_room(size_t bytes, int frame) {
+    if(texture_budget == 0) return true;
+
+    while(resident_bytes + bytes > texture_budget) {
+        if(!evict_texture_level(frame)) return false;
     }
-}
\ No newline at end of file
+    return true;
+}
+
+void update_texture_residency(void) {
+    int frame = ++residency_frame;
+    install_finished_streams();
+
+    // the rasterizer sampled the finest resident level in place of the evicted ones it
+    // wanted, so that's the level that was used
+    for(int i = 0; i < array_length(textures); ++i) {
+        texture_t* texture = textures[i];
+        for(int level = 0; level < texture->num_levels; ++level) {
+            if(!(texture->used_levels & (1u << level))) continue;
+            int sampled = (level > texture->first_level) ? level : texture->first_level;
+            if(sampled < texture->num_levels) texture->levels[sampled].last_used = frame;
+        }
+    }
+
+    // decoding the finest level that was wanted and the ones after it again, as long as
+    // that only evicts levels that weren't used in the last frame
+    for(int i = 0; i < array_length(textures); ++i) {
+        texture_t* texture = textures[i];
+        int wanted = 0;
+        while(wanted < texture->num_levels && !(texture->used_levels & (1u << wanted))) ++wanted;
+        texture->used_levels = 0;
+        if(wanted >= texture->first_level || !texture->can_reload || texture->is_streaming) continue;
+
+        size_t bytes = 0;
+        for(int level = wanted; level < texture->first_level; ++level) {
+            bytes += get_texture_level_bytes(&texture->levels[level]);
+        }
+        if(make_texture_room(bytes, frame)) request_texture_stream(texture, wanted, NULL, false);
+    }
+
+    // and when even the levels in use don't fit, the finest of them go
+    make_texture_room(0, INT_MAX);
+}
+
+void free_textures(void) {
+    // the streaming thread stops after the png it's decoding; the rest are dropped
+    if(is_stream_thread_started) {
+        pthread_mutex_lock(&stream_mutex);
+        is_stream_thread_quitting = true;
+        pthread_cond_signal(&stream_requested);
+        pthread_mutex_unlock(&stream_mutex);
+        pthread_join(stream_thread, NULL);
+        is_stream_thread_started = false;
+        is_stream_thread_quitting = false;
+    }
+    while(pending_streams != NULL) {
+        texture_stream_t* next = pending_streams->next;
+        if(pending_streams->png != NULL) upng_free(pending_streams->png);
+        free(pending_streams);
+        pending_streams = next;
+    }
+    last_pending_stream = NULL;
+    install_finished_streams();
+
+    for(int i = 0; i < array_length(textures); ++i) {
+        texture_t* texture = textures[i];
+        for(int level = 0; level < texture->num_levels; ++level) free(texture->levels[level].texels);
+        free(texture->filename);
+        free(texture);
+    }
+    array_free(textures);
+    textures = NULL;
+
+    for(int level = 0; level < default_texture.num_levels; ++level) free(default_texture.levels[level].texels);
+    default_texture.num_levels = 0;
+    resident_bytes = 0;
+}
@@ -0,0 +1,125 @@
+// stat() is POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "headers/texture_cache.h"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    int64_t source_size;
+    int64_t source_mtime_ns;
+    int32_t width;      // of level 0, which tells the sizes of all the others
+    int32_t height;
+    int32_t first_level;
+    int32_t num_levels;
+} texture_cache_header_t;
+
+// the modification time of a file, in nanoseconds
+static int64_t get_mtime_ns(struct stat* file_stat) {
+#ifdef __APPLE__
+    struct timespec mtime = file_stat->st_mtimespec;
+#else
+    struct timespec mtime = file_stat->st_mtim;
+#endif
+    return (int64_t)mtime.tv_sec * 1000000000 + mtime.tv_nsec;
+}
+
+static void get_cache_filename(char* png_filename, char* cache_filename, size_t size) {
+    snprintf(cache_filename, size, "%s%s", png_filename, TEXTURE_CACHE_EXTENSION);
+}
+
+bool load_texture_cache(texture_t* texture, char* png_filename) {
+    char cache_filename[1024];
+    get_cache_filename(png_filename, cache_filename, sizeof(cache_filename));
+
+    struct stat source_stat;
+    if(stat(png_filename, &source_stat) != 0) return false;
+
+    FILE* file = fopen(cache_filename, "rb");
+    if(!file) return false;
+
+    texture_cache_header_t header;
+    bool is_valid =
+        fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == TEXTURE_CACHE_MAGIC &&
+        header.version == TEXTURE_CACHE_VERSION &&
+        header.header_size == sizeof(texture_cache_header_t) &&
+        header.source_size == (int64_t)source_stat.st_size &&
+        header.source_mtime_ns == get_mtime_ns(&source_stat) &&
+        header.width == texture->levels[0].width &&
+        header.height == texture->levels[0].height &&
+        header.num_levels == texture->num_levels &&
+        header.first_level >= 0 && header.first_level < header.num_levels;
+
+    uint32_t* texels[TEXTURE_MAX_LEVELS] = { NULL };
+    for(int i = header.first_level; i < header.num_levels && is_valid; ++i){
+        size_t size = get_texture_level_bytes(&texture->levels[i]);
+        texels[i] = (uint32_t*)malloc(size);
+        is_valid = texels[i] != NULL && fread(texels[i], 1, size, file) == size;
+    }
+    fclose(file);
+
+    if(!is_valid){
+        for(int i = 0; i < TEXTURE_MAX_LEVELS; ++i) free(texels[i]);
+        return false;
+    }
+
+    for(int i = header.first_level; i < header.num_levels; ++i){
+        texture->levels[i].texels = texels[i];
+    }
+    texture->first_level = header.first_level;
+    return true;
+}
+
+// written to a temporary file and renamed, so another instance never reads a half
+// written cache
+bool save_texture_cache(const texture_level_t* levels, int num_levels, char* png_filename) {
+    struct stat source_stat;
+    if(stat(png_filename, &source_stat) != 0) return false;
+
+    char cache_filename[1024];
+    char temp_filename[1040];
+    get_cache_filename(png_filename, cache_filename, sizeof(cache_filename));
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", cache_filename);
+
+    int first_level = 0;
+    while(first_level < num_levels - 1 && (levels[first_level].width > TEXTURE_CACHE_LEVEL_SIZE || levels[first_level].height > TEXTURE_CACHE_LEVEL_SIZE)){
+        ++first_level;
+    }
+    texture_cache_header_t header = {
+        .magic = TEXTURE_CACHE_MAGIC,
+        .version = TEXTURE_CACHE_VERSION,
+        .header_size = sizeof(texture_cache_header_t),
+        .source_size = source_stat.st_size,
+        .source_mtime_ns = get_mtime_ns(&source_stat),
+        .width = levels[0].width,
+        .height = levels[0].height,
+        .first_level = first_level,
+        .num_levels = num_levels
+    };
+
+    FILE* file = fopen(temp_filename, "wb");
+    if(!file){
+        fprintf(stderr, "Error: Could not write the texture cache %s\n", cache_filename);
+        return false;
+    }
+
+    bool is_written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for(int i = first_level; i < num_levels && is_written; ++i){
+        size_t size = get_texture_level_bytes(&levels[i]);
+        is_written = fwrite(levels[i].texels, 1, size, file) == size;
+    }
+    is_written = (fclose(file) == 0) && is_written;
+
+    if(!is_written || rename(temp_filename, cache_filename) != 0){
+        fprintf(stderr, "Error: Could not write the texture cache %s\n", cache_filename);
+        remove(temp_filename);
+        return false;
+    }
+    return true;
+}
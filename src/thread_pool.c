@@ -0,0 +1,119 @@
+// pthreads and sysconf() are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "headers/thread_pool.h"
+
+static pthread_t* workers = NULL;
+static int num_workers = 0; // threads created by the pool; the calling thread is extra
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+
+// the batch being run; written under the mutex before `generation` is bumped
+static thread_job_t current_job = NULL;
+static void* current_context = NULL;
+static int current_count = 0;
+static int next_index = 0;      // claimed with an atomic add, so threads that finish early take more
+static int generation = 0;      // bumped for every batch, so workers can tell a new one from a spurious wakeup
+static int busy_workers = 0;
+static bool is_shutting_down = false;
+
+static void run_jobs(int thread) {
+    while(true) {
+        int index = __sync_fetch_and_add(&next_index, 1);
+        if(index >= current_count) break;
+        current_job(current_context, index, thread);
+    }
+}
+
+static void* worker_main(void* arg) {
+    int thread = (int)(intptr_t)arg;
+    int seen_generation = 0;
+
+    pthread_mutex_lock(&mutex);
+    while(true) {
+        while(generation == seen_generation && !is_shutting_down) {
+            pthread_cond_wait(&work_ready, &mutex);
+        }
+        if(is_shutting_down) break;
+        seen_generation = generation;
+        pthread_mutex_unlock(&mutex);
+
+        run_jobs(thread);
+
+        pthread_mutex_lock(&mutex);
+        if(--busy_workers == 0) pthread_cond_signal(&work_done);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return NULL;
+}
+
+void thread_pool_init(int num_threads) {
+    if(num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_threads <= 0) num_threads = 1;
+
+    workers = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    num_workers = 0;
+    is_shutting_down = false;
+
+    for(int i = 1; i < num_threads; ++i) {
+        if(pthread_create(&workers[num_workers], NULL, worker_main, (void*)(intptr_t)i) != 0) {
+            fprintf(stderr, "Error: could only create %d of %d threads\n", i, num_threads);
+            break;
+        }
+        ++num_workers;
+    }
+}
+
+int thread_pool_size(void) {
+    return num_workers + 1;
+}
+
+void thread_pool_run(thread_job_t job, void* context, int count) {
+    // not worth waking anyone up for
+    if(num_workers == 0 || count <= 1) {
+        for(int i = 0; i < count; ++i) job(context, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    current_job = job;
+    current_context = context;
+    current_count = count;
+    next_index = 0;
+    busy_workers = num_workers;
+    ++generation;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&mutex);
+
+    // the calling thread works too, instead of just waiting
+    run_jobs(0);
+
+    pthread_mutex_lock(&mutex);
+    while(busy_workers > 0) {
+        pthread_cond_wait(&work_done, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void thread_pool_free(void) {
+    pthread_mutex_lock(&mutex);
+    is_shutting_down = true;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&mutex);
+
+    for(int i = 0; i < num_workers; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+}
@@ -0,0 +1,15 @@
+// clock_gettime() is POSIX, not C99
+#define _POSIX_C_SOURCE 199309L
+
+#include <time.h>
+#include "headers/timer.h"
+
+uint64_t timer_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+double timer_now_ms(void) {
+    return timer_now_ns() / 1000000.0;
+}
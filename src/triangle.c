@@ -1,206 +1,638 @@
+#include <math.h>
+#include <stdlib.h>
 #include "headers/triangle.h"
+#include "headers/clipping.h"
 #include "headers/display.h"
-#include "headers/swap.h"
 
-void fill_flat_bottom_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int color){
-    // finding the two slopes
-    float inv_slope_1 = (float)(x1 - x0) / (y1 - y0);
-    float inv_slope_2 = (float)(x2 - x0) / (y2 - y0);
-
-    float x_start = x0;
-    float x_end = x0;
-
-    for(int y = y0; y <= y2; ++y){
-        draw_line(x_start, y, x_end, y, color);
-        x_start += inv_slope_1;
-        x_end += inv_slope_2;
+// filled and textured pixels are shaded RASTER_BATCH_SIZE at a time, using the widest instruction
+// set the compiler targets (e.g. build with -mavx2 or -march=native for AVX2); the lane
+// masks are all ones (passed) or all zeros (failed)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RASTER_BATCH_SIZE 8
+typedef __m256 vfloat_t;
+typedef __m256i vint_t;
+#define vfloat_set1 _mm256_set1_ps
+#define vfloat_load _mm256_loadu_ps
+#define vfloat_store _mm256_storeu_ps
+#define vfloat_add _mm256_add_ps
+#define vfloat_sub _mm256_sub_ps
+#define vfloat_mul _mm256_mul_ps
+#define vfloat_div _mm256_div_ps
+#define vfloat_less(a, b) _mm256_castps_si256(_mm256_cmp_ps((a), (b), _CMP_LT_OQ))
+#define vfloat_blend(if_false, if_true, mask) _mm256_blendv_ps((if_false), (if_true), _mm256_castsi256_ps(mask))
+#define vfloat_to_vint _mm256_cvttps_epi32
+#define vint_set1 _mm256_set1_epi32
+#define vint_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vint_store(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define vint_add _mm256_add_epi32
+#define vint_sub _mm256_sub_epi32
+#define vint_and _mm256_and_si256
+#define vint_or _mm256_or_si256
+#define vint_xor _mm256_xor_si256
+#define vint_greater _mm256_cmpgt_epi32
+#define vint_sign(v) _mm256_srai_epi32((v), 31)
+#define vint_shift_left(v, n) _mm256_sll_epi32((v), _mm_cvtsi32_si128(n))
+#define vint_shift_right(v, n) _mm256_srl_epi32((v), _mm_cvtsi32_si128(n))
+#define vint_is_zero(v) _mm256_testz_si256((v), (v))
+#define vint_blend(if_false, if_true, mask) _mm256_blendv_epi8((if_false), (if_true), (mask))
+// fetching texture[index] for the passed lanes; the others keep their value from 'old'
+#define vint_gather(old, texture, index, mask) _mm256_mask_i32gather_epi32((old), (const int*)(texture), (index), (mask), 4)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RASTER_BATCH_SIZE 4
+typedef __m128 vfloat_t;
+typedef __m128i vint_t;
+#define vfloat_set1 _mm_set1_ps
+#define vfloat_load _mm_loadu_ps
+#define vfloat_store _mm_storeu_ps
+#define vfloat_add _mm_add_ps
+#define vfloat_sub _mm_sub_ps
+#define vfloat_mul _mm_mul_ps
+#define vfloat_div _mm_div_ps
+#define vfloat_less(a, b) _mm_castps_si128(_mm_cmplt_ps((a), (b)))
+#define vfloat_blend(if_false, if_true, mask) \
+    _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(mask), (if_true)), _mm_andnot_ps(_mm_castsi128_ps(mask), (if_false)))
+#define vfloat_to_vint _mm_cvttps_epi32
+#define vint_set1 _mm_set1_epi32
+#define vint_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define vint_store(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define vint_add _mm_add_epi32
+#define vint_sub _mm_sub_epi32
+#define vint_and _mm_and_si128
+#define vint_or _mm_or_si128
+#define vint_xor _mm_xor_si128
+#define vint_greater _mm_cmpgt_epi32
+#define vint_sign(v) _mm_srai_epi32((v), 31)
+#define vint_shift_left(v, n) _mm_sll_epi32((v), _mm_cvtsi32_si128(n))
+#define vint_shift_right(v, n) _mm_srl_epi32((v), _mm_cvtsi32_si128(n))
+#define vint_is_zero(v) (_mm_movemask_epi8(v) == 0)
+#define vint_blend(if_false, if_true, mask) _mm_or_si128(_mm_and_si128((mask), (if_true)), _mm_andnot_si128((mask), (if_false)))
+// SSE2 has no gather; fetching the passed lanes one by one
+static inline vint_t vint_gather(vint_t old, uint32_t* texture, vint_t index, vint_t mask) {
+    uint32_t texels[4];
+    int32_t indices[4];
+    int32_t passed[4];
+    vint_store(texels, old);
+    vint_store(indices, index);
+    vint_store(passed, mask);
+    for(int i = 0; i < 4; ++i){
+        if(passed[i]) texels[i] = texture[indices[i]];
     }
+    return vint_load(texels);
+}
+#else
+#define RASTER_BATCH_SIZE 1
+#endif
+
+// the filled and textured triangles are drawn with edge functions: each edge is a line
+// equation that is >= 0 on the inside, stepped with integer adds from pixel to pixel.
+// vertices are snapped to 1/16th of a pixel so shared edges give the exact same values
+// for both triangles, and the top-left rule decides who owns the pixels lying exactly on an edge
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+
+// the screen is walked in 8x8 blocks; an edge that covers a whole block isn't tested
+// for any of its pixels, and a block outside any of the edges is skipped
+#define RASTER_BLOCK_SIZE 8
+
+#if RASTER_BLOCK_SIZE != HIZ_BLOCK_SIZE
+#error "the blocks of the rasterizer must be those of hiz_buffer"
+#endif
+
+// slack added to the depth bounds of a triangle before they're compared with hiz_buffer,
+// larger than the rounding differences between the bounds and the per-pixel depths
+#define HIZ_DEPTH_EPSILON 1e-5f
+
+typedef struct {
+    int64_t c;      // value at pixel (0, 0), including the top-left bias
+    int64_t step_x; // change per pixel to the right
+    int64_t step_y; // change per pixel down
+} edge_t;
+
+// a triangle set up for the edge rasterizer
+typedef struct {
+    edge_t edges[3];
+    int b;                      // the vertex order (0, b, c) is clockwise on screen
+    int c;
+    float origin_x;             // vertex 0, snapped
+    float origin_y;
+    float ab_x, ab_y;           // vertex 0 to b and vertex 0 to c, snapped
+    float ac_x, ac_y;
+    float inv_area;
+    int min_x, min_y;           // the pixels to walk, inside the clip rect
+    int max_x, max_y;
+    float reciprocal_w0;        // 1/w at vertex 0, and its change per pixel
+    float reciprocal_w_dx;
+    float reciprocal_w_dy;
+    bool use_hiz;               // false when a vertex is behind the camera (w <= 0)
+    float min_depth;            // the depth of the nearest vertex, for the hiz_buffer tests
+    int32_t lane_e[3][RASTER_BLOCK_SIZE]; // the change of each edge value from lane 0 of a block row
+} raster_triangle_t;
+
+// the edge values of one 8x8 block: those of its first row at lane 0, their change
+// per row, and their offset at each lane of a row
+typedef struct {
+    int32_t row_e[3];
+    int32_t e_dy[3];
+    const int32_t* lane_e[3];
+    float* hiz;                 // the block in hiz_buffer, NULL when it isn't used
+    bool is_covered;            // true when the triangle covers every pixel of the block
+} raster_block_t;
+
+// the lane offsets of an edge that covers the whole block
+static const int32_t no_lane_e[RASTER_BLOCK_SIZE] = { 0 };
+
+// one row of an 8x8 block; the values are those of its first pixel (lane 0)
+typedef struct {
+    uint32_t* colors;
+    float* depths;
+    int32_t e[3];
+    float reciprocal_w;
+    float u_over_w;             // textured triangles only
+    float v_over_w;
+} raster_row_t;
+
+// the edge from (x0, y0) to (x1, y1) of a triangle wound clockwise on screen, in subpixels;
+// sampled at the pixel centers. the -1 bias on edges that are not top or left edges makes
+// a pixel center exactly on them fail the (>= 0) test
+static edge_t make_edge(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+    int64_t dx = x1 - x0;
+    int64_t dy = y1 - y0;
+    bool is_top_left = (dy < 0) || (dy == 0 && dx > 0);
+
+    edge_t edge = {
+        .c = dx * (SUBPIXEL_ONE / 2 - y0) - dy * (SUBPIXEL_ONE / 2 - x0) - (is_top_left ? 0 : 1),
+        .step_x = -dy * SUBPIXEL_ONE,
+        .step_y = dx * SUBPIXEL_ONE
+    };
+    return edge;
 }
 
-void fill_flat_top_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int color){
-    // finding the two slopes
-    float inv_slope_1 = (float)(x2 - x0) / (y2 - y0);
-    float inv_slope_2 = (float)(x2 - x1) / (y2 - y1);
-
-    float x_start = x2;
-    float x_end = x2;
+// the change per pixel of an attribute that is linear in screen space, from its values at the vertices
+static void attribute_gradients(const raster_triangle_t* triangle, const float f[3], float* f_dx, float* f_dy) {
+    float ab = f[triangle->b] - f[0];
+    float ac = f[triangle->c] - f[0];
+    *f_dx = (ab * triangle->ac_y - ac * triangle->ab_y) * triangle->inv_area;
+    *f_dy = (ac * triangle->ab_x - ab * triangle->ac_x) * triangle->inv_area;
+}
 
-    for(int y = y2; y >= y0; --y){
-        draw_line(x_start, y, x_end, y, color);
-        x_start -= inv_slope_1;
-        x_end -= inv_slope_2;
-    }
+// an attribute at the center of pixel (x, y)
+static float attribute_at(const raster_triangle_t* triangle, float f0, float f_dx, float f_dy, int x, int y) {
+    return f0 + f_dx * (x + 0.5f - triangle->origin_x) + f_dy * (y + 0.5f - triangle->origin_y);
 }
 
-void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color){
-    if(y0 > y1){
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
+// snapping the vertices and building the edges, the bounding box and the 1/w gradients
+// of the triangle; false if there's nothing to draw, or if hiz_buffer shows that all of
+// it is hidden
+static bool setup_raster_triangle(const float x[3], const float y[3], const float w[3], raster_triangle_t* triangle) {
+    for(int i = 0; i < 3; ++i){
+        // also false for NaN (points with w = 0)
+        if(!(fabsf(x[i]) <= MAX_VERTEX_COORD && fabsf(y[i]) <= MAX_VERTEX_COORD)) return false;
     }
 
-    if(y1 > y2){
-        int_swap(&y1, &y2);
-        int_swap(&x1, &x2);
+    int64_t sx[3], sy[3];
+    for(int i = 0; i < 3; ++i){
+        sx[i] = lrintf(x[i] * SUBPIXEL_ONE);
+        sy[i] = lrintf(y[i] * SUBPIXEL_ONE);
     }
 
-    if(y0 > y1){
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-    }
+    int64_t area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+    if(area == 0) return false;
 
-    if(y1 == y2){
-        fill_flat_bottom_triangle(x0, y0, x1, y1, x2, y2, color);
-    } else if(y0 == y1){
-        fill_flat_top_triangle(x0, y0, x1, y1, x2, y2, color);
-    } else {
-        int M_y = y1;
-        int M_x = ((float)((x2 - x0) * (y1 - y0)) / (float)(y2 - y0)) + x0;
-        
-        fill_flat_bottom_triangle(x0, y0, x1, y1, M_x, M_y, color);
-        fill_flat_top_triangle(x1, y1, M_x, M_y, x2, y2, color);
+    // making the winding clockwise on screen, so the inside of every edge is positive
+    int b = 1;
+    int c = 2;
+    if(area < 0){
+        b = 2;
+        c = 1;
+        area = -area;
     }
-}
-
-vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p) {
-    vec2_t ac = vec2_sub(c, a);
-    vec2_t ab = vec2_sub(b, a);
-    vec2_t ap = vec2_sub(p, a);
-    vec2_t pc = vec2_sub(c, p);
-    vec2_t pb = vec2_sub(b, p);
 
-    float area_parallelogram_abc = (ac.x * ab.y - ac.y * ab.x);
+    triangle->edges[0] = make_edge(sx[0], sy[0], sx[b], sy[b]);
+    triangle->edges[1] = make_edge(sx[b], sy[b], sx[c], sy[c]);
+    triangle->edges[2] = make_edge(sx[c], sy[c], sx[0], sy[0]);
+    triangle->b = b;
+    triangle->c = c;
 
-    float alpha = (pc.x * pb.y - pc.y * pb.x) / area_parallelogram_abc;
-    float beta = (ac.x * ap.y - ac.y * ap.x) / area_parallelogram_abc;
-    float gamma = 1 - alpha - beta;
+    for(int i = 0; i < 3; ++i){
+        for(int lane = 0; lane < RASTER_BLOCK_SIZE; ++lane){
+            triangle->lane_e[i][lane] = (int32_t)triangle->edges[i].step_x * lane;
+        }
+    }
 
-    vec3_t weights = { alpha, beta, gamma };
-    return weights;
+    triangle->origin_x = (float)sx[0] / SUBPIXEL_ONE;
+    triangle->origin_y = (float)sy[0] / SUBPIXEL_ONE;
+    triangle->ab_x = (float)(sx[b] - sx[0]) / SUBPIXEL_ONE;
+    triangle->ab_y = (float)(sy[b] - sy[0]) / SUBPIXEL_ONE;
+    triangle->ac_x = (float)(sx[c] - sx[0]) / SUBPIXEL_ONE;
+    triangle->ac_y = (float)(sy[c] - sy[0]) / SUBPIXEL_ONE;
+    triangle->inv_area = (float)(SUBPIXEL_ONE * SUBPIXEL_ONE) / area;
+
+    // the pixels whose centers are inside the bounding box, clamped to the clip rect
+    rect_t clip = get_clip_rect();
+    int64_t min_sx = sx[0] < sx[1] ? (sx[0] < sx[2] ? sx[0] : sx[2]) : (sx[1] < sx[2] ? sx[1] : sx[2]);
+    int64_t min_sy = sy[0] < sy[1] ? (sy[0] < sy[2] ? sy[0] : sy[2]) : (sy[1] < sy[2] ? sy[1] : sy[2]);
+    int64_t max_sx = sx[0] > sx[1] ? (sx[0] > sx[2] ? sx[0] : sx[2]) : (sx[1] > sx[2] ? sx[1] : sx[2]);
+    int64_t max_sy = sy[0] > sy[1] ? (sy[0] > sy[2] ? sy[0] : sy[2]) : (sy[1] > sy[2] ? sy[1] : sy[2]);
+
+    triangle->min_x = (int)((min_sx - SUBPIXEL_ONE / 2 + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+    triangle->min_y = (int)((min_sy - SUBPIXEL_ONE / 2 + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+    triangle->max_x = (int)((max_sx - SUBPIXEL_ONE / 2) >> SUBPIXEL_BITS);
+    triangle->max_y = (int)((max_sy - SUBPIXEL_ONE / 2) >> SUBPIXEL_BITS);
+    if(triangle->min_x < clip.x0) triangle->min_x = clip.x0;
+    if(triangle->min_y < clip.y0) triangle->min_y = clip.y0;
+    if(triangle->max_x > clip.x1 - 1) triangle->max_x = clip.x1 - 1;
+    if(triangle->max_y > clip.y1 - 1) triangle->max_y = clip.y1 - 1;
+    if(triangle->min_x > triangle->max_x || triangle->min_y > triangle->max_y) return false;
+
+    float reciprocal_w[3] = { 1.0 / w[0], 1.0 / w[1], 1.0 / w[2] };
+    triangle->reciprocal_w0 = reciprocal_w[0];
+    attribute_gradients(triangle, reciprocal_w, &triangle->reciprocal_w_dx, &triangle->reciprocal_w_dy);
+
+    // 1/w is only linear across the screen (and the depth bounds only hold) for triangles
+    // entirely in front of the camera
+    triangle->use_hiz = w[0] > 0 && w[1] > 0 && w[2] > 0;
+    if(!triangle->use_hiz) return true;
+
+    // the triangle is hidden if its nearest vertex is behind every block it overlaps
+    float max_reciprocal_w = fmaxf(reciprocal_w[0], fmaxf(reciprocal_w[1], reciprocal_w[2]));
+    triangle->min_depth = 1.0f - max_reciprocal_w - HIZ_DEPTH_EPSILON;
+
+    for(int hiz_y = triangle->min_y / HIZ_BLOCK_SIZE; hiz_y <= triangle->max_y / HIZ_BLOCK_SIZE; ++hiz_y){
+        float* hiz_row = &hiz_buffer[hiz_width * hiz_y];
+        for(int hiz_x = triangle->min_x / HIZ_BLOCK_SIZE; hiz_x <= triangle->max_x / HIZ_BLOCK_SIZE; ++hiz_x){
+            if(triangle->min_depth < hiz_row[hiz_x]) return true;
+        }
+    }
+    return false;
 }
 
-void draw_texel(
-    int x, int y, uint32_t* texture,
-    vec4_t point_a, vec4_t point_b, vec4_t point_c,
-    tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
-) {
-    vec2_t p = { x, y };
-    vec2_t a = vec2_from_vec4(point_a);
-    vec2_t b = vec2_from_vec4(point_b);
-    vec2_t c = vec2_from_vec4(point_c);
-
-    vec3_t weights = barycentric_weights(a, b, c, p);
-
-    float alpha = weights.x;
-    float beta = weights.y;
-    float gamma = weights.z;
-
-    float interpolated_u;
-    float interpolated_v;
-    float interpolated_reciprocal_w;
-
-    interpolated_u = (a_uv.u / point_a.w) * alpha + (b_uv.u / point_b.w) * beta + (c_uv.u / point_c.w) * gamma;
-    interpolated_v = (a_uv.v / point_a.w) * alpha + (b_uv.v / point_b.w) * beta + (c_uv.v / point_c.w) * gamma;
+// classifying the pixels [first_x, last_x] x [first_y, last_y] of the block starting at
+// column block_x against hiz_buffer and each edge (from the edge values at their corners);
+// false if the triangle is behind the block or they're all outside one of the edges. an edge
+// covering all of them gets a value and steps of 0, so it always passes
+static bool setup_raster_block(const raster_triangle_t* triangle, int block_x, int first_x, int last_x, int first_y, int last_y, raster_block_t* block) {
+    block->hiz = NULL;
+    if(triangle->use_hiz){
+        block->hiz = &hiz_buffer[(hiz_width * (first_y / HIZ_BLOCK_SIZE)) + (first_x / HIZ_BLOCK_SIZE)];
+        if(triangle->min_depth >= *block->hiz) return false;
+    }
 
-    interpolated_reciprocal_w = (1 / point_a.w) * alpha + (1 / point_b.w) * beta + (1 / point_c.w) * gamma;
+    block->is_covered = (last_x - first_x == RASTER_BLOCK_SIZE - 1) && (last_y - first_y == RASTER_BLOCK_SIZE - 1);
+
+    for(int i = 0; i < 3; ++i){
+        const edge_t* edge = &triangle->edges[i];
+
+        int64_t e = edge->c + edge->step_x * first_x + edge->step_y * first_y;
+        int64_t span_x = edge->step_x * (last_x - first_x);
+        int64_t span_y = edge->step_y * (last_y - first_y);
+        int64_t e_max = e + (span_x > 0 ? span_x : 0) + (span_y > 0 ? span_y : 0);
+        int64_t e_min = e + (span_x < 0 ? span_x : 0) + (span_y < 0 ? span_y : 0);
+
+        if(e_max < 0) return false;
+
+        if(e_min >= 0){
+            block->row_e[i] = 0;
+            block->e_dy[i] = 0;
+            block->lane_e[i] = no_lane_e;
+        } else {
+            // the value at lane 0 (block_x), which may be left of first_x
+            block->row_e[i] = (int32_t)(edge->c + edge->step_x * block_x + edge->step_y * first_y);
+            block->e_dy[i] = (int32_t)edge->step_y;
+            block->lane_e[i] = triangle->lane_e[i];
+            block->is_covered = false;
+        }
+    }
+    return true;
+}
 
-    interpolated_u /= interpolated_reciprocal_w;
-    interpolated_v /= interpolated_reciprocal_w;
+// after drawing a triangle that covers the whole block (starting at pixel (x, y)), none
+// of its pixels can be further than the triangle's farthest point in it; 1/w is linear
+// in screen space, so that's at one of the block's corners
+static void update_hiz(const raster_triangle_t* triangle, const raster_block_t* block, int x, int y) {
+    if(block->hiz == NULL || !block->is_covered) return;
 
-    int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-    int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
+    float reciprocal_w = attribute_at(triangle, triangle->reciprocal_w0, triangle->reciprocal_w_dx, triangle->reciprocal_w_dy, x, y);
+    float span_x = triangle->reciprocal_w_dx * (RASTER_BLOCK_SIZE - 1);
+    float span_y = triangle->reciprocal_w_dy * (RASTER_BLOCK_SIZE - 1);
+    float max_depth = 1.0f - (reciprocal_w + fminf(span_x, 0) + fminf(span_y, 0)) + HIZ_DEPTH_EPSILON;
 
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+    if(max_depth < *block->hiz) *block->hiz = max_depth;
+}
 
-    if(interpolated_reciprocal_w < z_buffer[(window_width * y) + x]){
-        draw_pixel(x, y, texture[(texture_width * tex_y) + tex_x]);
-        z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+// filling the pixels of a block row one at a time, computing each of them from lane 0
+// like the batched version does
+static void fill_lanes(const raster_block_t* block, const raster_row_t* row, float reciprocal_w_dx, uint32_t color, int first_lane, int last_lane) {
+    for(int lane = first_lane; lane <= last_lane; ++lane){
+        int32_t e0 = row->e[0] + block->lane_e[0][lane];
+        int32_t e1 = row->e[1] + block->lane_e[1][lane];
+        int32_t e2 = row->e[2] + block->lane_e[2][lane];
+        if((e0 | e1 | e2) < 0) continue;
+
+        float depth = 1.0f - (row->reciprocal_w + reciprocal_w_dx * lane);
+        if(depth < row->depths[lane]){
+            row->colors[lane] = color;
+            row->depths[lane] = depth;
+        }
     }
 }
 
-void draw_textured_triangle(
-    int x0, int y0, float z0, float w0, float u0, float v0, 
-    int x1, int y1, float z1, float w1, float u1, float v1, 
-    int x2, int y2, float z2, float w2, float u2, float v2,
-    uint32_t* texture
-){
-    if(y0 > y1){
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-        float_swap(&z0, &z1);
-        float_swap(&w0, &w1);
-        float_swap(&u0, &u1);
-        float_swap(&v0, &v1);
+#if RASTER_BATCH_SIZE > 1
+static const float lane_offsets[RASTER_BLOCK_SIZE] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+// edge and depth test of RASTER_BATCH_SIZE pixels of a block row starting at 'lane',
+// and one store of the depths and colors with the failed lanes keeping their old values
+static void fill_batch(const raster_block_t* block, const raster_row_t* row, float reciprocal_w_dx, uint32_t color, int lane) {
+    vint_t e0 = vint_add(vint_set1(row->e[0]), vint_load(&block->lane_e[0][lane]));
+    vint_t e1 = vint_add(vint_set1(row->e[1]), vint_load(&block->lane_e[1][lane]));
+    vint_t e2 = vint_add(vint_set1(row->e[2]), vint_load(&block->lane_e[2][lane]));
+    vint_t mask = vint_greater(vint_or(vint_or(e0, e1), e2), vint_set1(-1));
+    if(vint_is_zero(mask)) return;
+
+    vfloat_t lanes = vfloat_load(&lane_offsets[lane]);
+    vfloat_t reciprocal_w = vfloat_add(vfloat_set1(row->reciprocal_w), vfloat_mul(vfloat_set1(reciprocal_w_dx), lanes));
+    vfloat_t depth = vfloat_sub(vfloat_set1(1.0f), reciprocal_w);
+    vfloat_t old_depth = vfloat_load(&row->depths[lane]);
+    mask = vint_and(mask, vfloat_less(depth, old_depth));
+    if(vint_is_zero(mask)) return;
+
+    vfloat_store(&row->depths[lane], vfloat_blend(old_depth, depth, mask));
+    vint_t old_color = vint_load(&row->colors[lane]);
+    vint_store(&row->colors[lane], vint_blend(old_color, vint_set1(color), mask));
+}
+#endif
+
+// filling the lanes [first_lane, last_lane] of a block row; full batches go through
+// the SIMD path, the rest one pixel at a time
+static void fill_row(const raster_block_t* block, const raster_row_t* row, float reciprocal_w_dx, uint32_t color, int first_lane, int last_lane) {
+#if RASTER_BATCH_SIZE > 1
+    for(int lane = 0; lane < RASTER_BLOCK_SIZE; lane += RASTER_BATCH_SIZE){
+        int batch_last = lane + RASTER_BATCH_SIZE - 1;
+        if(lane >= first_lane && batch_last <= last_lane){
+            fill_batch(block, row, reciprocal_w_dx, color, lane);
+        } else if(batch_last >= first_lane && lane <= last_lane){
+            fill_lanes(
+                block, row, reciprocal_w_dx, color,
+                (lane > first_lane) ? lane : first_lane,
+                (batch_last < last_lane) ? batch_last : last_lane
+            );
+        }
     }
+#else
+    fill_lanes(block, row, reciprocal_w_dx, color, first_lane, last_lane);
+#endif
+}
 
-    if(y1 > y2){
-        int_swap(&y1, &y2);
-        int_swap(&x1, &x2);
-        float_swap(&z1, &z2);
-        float_swap(&w1, &w2);
-        float_swap(&u1, &u2);
-        float_swap(&v1, &v2);
+// the flat filled triangles interpolate 1/w for their depth like the textured ones, so
+// they don't depend on the painter's order (see raster_needs_painter_order())
+void draw_filled_triangle(
+    float x0, float y0, float w0,
+    float x1, float y1, float w1,
+    float x2, float y2, float w2,
+    uint32_t color
+){
+    float x[3] = { x0, x1, x2 };
+    float y[3] = { y0, y1, y2 };
+    float w[3] = { w0, w1, w2 };
+    raster_triangle_t triangle;
+    if(!setup_raster_triangle(x, y, w, &triangle)) return;
+
+    rect_t clip = get_clip_rect();
+
+    for(int block_y = triangle.min_y & ~(RASTER_BLOCK_SIZE - 1); block_y <= triangle.max_y; block_y += RASTER_BLOCK_SIZE){
+        int first_y = (block_y > triangle.min_y) ? block_y : triangle.min_y;
+        int last_y = (block_y + RASTER_BLOCK_SIZE - 1 < triangle.max_y) ? block_y + RASTER_BLOCK_SIZE - 1 : triangle.max_y;
+
+        for(int block_x = triangle.min_x & ~(RASTER_BLOCK_SIZE - 1); block_x <= triangle.max_x; block_x += RASTER_BLOCK_SIZE){
+            int first_x = (block_x > clip.x0) ? block_x : clip.x0;
+            int last_x = (block_x + RASTER_BLOCK_SIZE - 1 < clip.x1 - 1) ? block_x + RASTER_BLOCK_SIZE - 1 : clip.x1 - 1;
+
+            raster_block_t block;
+            if(!setup_raster_block(&triangle, block_x, first_x, last_x, first_y, last_y, &block)) continue;
+
+            for(int y = first_y; y <= last_y; ++y){
+                raster_row_t row = {
+                    .colors = &color_buffer[(window_width * y) + block_x],
+                    .depths = &z_buffer[(window_width * y) + block_x],
+                    .e = { block.row_e[0], block.row_e[1], block.row_e[2] },
+                    .reciprocal_w = attribute_at(&triangle, triangle.reciprocal_w0, triangle.reciprocal_w_dx, triangle.reciprocal_w_dy, block_x, y)
+                };
+                fill_row(&block, &row, triangle.reciprocal_w_dx, color, first_x - block_x, last_x - block_x);
+
+                block.row_e[0] += block.e_dy[0];
+                block.row_e[1] += block.e_dy[1];
+                block.row_e[2] += block.e_dy[2];
+            }
+            update_hiz(&triangle, &block, block_x, block_y);
+        }
     }
+}
 
-    if(y0 > y1){
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-        float_swap(&z0, &z1);
-        float_swap(&w0, &w1);
-        float_swap(&u0, &u1);
-        float_swap(&v0, &v1);
+typedef struct {
+    texture_level_t level; // the mip level sampled by the current block
+    int tile_row_shift;    // log2(level.tile_row_stride) for power of two levels, -1 for the others
+    float reciprocal_w_dx;
+    float u_over_w_dx;
+    float v_over_w_dx;
+    raster_block_t block; // the edge values of the current block
+} textured_setup_t;
+
+// shading the pixels of a block row one at a time; the values of each pixel are computed
+// from lane 0 the same way as the batched version does, so both give the same image
+static void shade_textured_lanes(const textured_setup_t* setup, const raster_row_t* row, int first_lane, int last_lane) {
+    for(int lane = first_lane; lane <= last_lane; ++lane){
+        int32_t e0 = row->e[0] + setup->block.lane_e[0][lane];
+        int32_t e1 = row->e[1] + setup->block.lane_e[1][lane];
+        int32_t e2 = row->e[2] + setup->block.lane_e[2][lane];
+        if((e0 | e1 | e2) < 0) continue;
+
+        // depth test first; u and v are only needed for the pixels that pass it
+        float reciprocal_w = row->reciprocal_w + setup->reciprocal_w_dx * lane;
+        float depth = 1.0f - reciprocal_w;
+        if(!(depth < row->depths[lane])) continue;
+
+        float u = (row->u_over_w + setup->u_over_w_dx * lane) / reciprocal_w;
+        float v = (row->v_over_w + setup->v_over_w_dx * lane) / reciprocal_w;
+
+        int tex_x = abs((int)(u * setup->level.width)) % setup->level.width;
+        int tex_y = abs((int)(v * setup->level.height)) % setup->level.height;
+
+        row->colors[lane] = setup->level.texels[texel_offset(&setup->level, tex_x, tex_y)];
+        row->depths[lane] = depth;
     }
+}
 
-    v0 = 1.0 - v0;
-    v1 = 1.0 - v1;
-    v2 = 1.0 - v2;
-
-    vec4_t point_a = { x0, y0, z0, w0 };
-    vec4_t point_b = { x1, y1, z1, w1 };
-    vec4_t point_c = { x2, y2, z2, w2 };
-
-    tex2_t a_uv = { u0, v0 };
-    tex2_t b_uv = { u1, v1 };
-    tex2_t c_uv = { u2, v2 };
-
-    float inv_slope_1 = 0;
-    float inv_slope_2 = 0;
-
-    if(y1 - y0 != 0) inv_slope_1 = (float)(x1 - x0) / abs(y1 - y0);
-    if(y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
-
-    if(y1 - y0 != 0){
-        for(int y = y0; y <= y1; ++y){
-            int x_start = x1 + (y - y1) * inv_slope_1;
-            int x_end = x0 + (y - y0) * inv_slope_2;
-
-            if(x_end < x_start){
-                int_swap(&x_start, &x_end);
-            }
-
-            for(int x = x_start; x < x_end; ++x){
-                draw_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+#if RASTER_BATCH_SIZE > 1
+// shading RASTER_BATCH_SIZE pixels of a block row, starting at 'lane': edge test, depth
+// test, u and v, wrap addressing and texel fetch for all of them, then one store of the
+// depths and colors with the failed lanes keeping their old values
+static void shade_textured_batch(const textured_setup_t* setup, const raster_row_t* row, int lane) {
+    vint_t e0 = vint_add(vint_set1(row->e[0]), vint_load(&setup->block.lane_e[0][lane]));
+    vint_t e1 = vint_add(vint_set1(row->e[1]), vint_load(&setup->block.lane_e[1][lane]));
+    vint_t e2 = vint_add(vint_set1(row->e[2]), vint_load(&setup->block.lane_e[2][lane]));
+    vint_t mask = vint_greater(vint_or(vint_or(e0, e1), e2), vint_set1(-1));
+    if(vint_is_zero(mask)) return;
+
+    vfloat_t lanes = vfloat_load(&lane_offsets[lane]);
+    vfloat_t reciprocal_w = vfloat_add(vfloat_set1(row->reciprocal_w), vfloat_mul(vfloat_set1(setup->reciprocal_w_dx), lanes));
+    vfloat_t depth = vfloat_sub(vfloat_set1(1.0f), reciprocal_w);
+    vfloat_t old_depth = vfloat_load(&row->depths[lane]);
+    mask = vint_and(mask, vfloat_less(depth, old_depth));
+    if(vint_is_zero(mask)) return;
+
+    vfloat_t u = vfloat_div(vfloat_add(vfloat_set1(row->u_over_w), vfloat_mul(vfloat_set1(setup->u_over_w_dx), lanes)), reciprocal_w);
+    vfloat_t v = vfloat_div(vfloat_add(vfloat_set1(row->v_over_w), vfloat_mul(vfloat_set1(setup->v_over_w_dx), lanes)), reciprocal_w);
+
+    // abs(x) % size, which is abs(x) & (size - 1) for power of two sizes
+    vint_t tex_x = vfloat_to_vint(vfloat_mul(u, vfloat_set1(setup->level.width)));
+    vint_t tex_y = vfloat_to_vint(vfloat_mul(v, vfloat_set1(setup->level.height)));
+    tex_x = vint_and(vint_sub(vint_xor(tex_x, vint_sign(tex_x)), vint_sign(tex_x)), vint_set1(setup->level.width - 1));
+    tex_y = vint_and(vint_sub(vint_xor(tex_y, vint_sign(tex_y)), vint_sign(tex_y)), vint_set1(setup->level.height - 1));
+
+    // texel_offset(): the row of tiles, then the tile in it (x / 4 * 16) and the texel in
+    // the tile (y % 4 * 4 + x % 4), with the middle two merged into ((x & ~3) | (y & 3)) * 4
+    vint_t tile_row = vint_shift_left(vint_shift_right(tex_y, 2), setup->tile_row_shift);
+    vint_t tile_and_row = vint_or(vint_and(tex_x, vint_set1(~3)), vint_and(tex_y, vint_set1(3)));
+    vint_t index = vint_add(vint_add(tile_row, vint_shift_left(tile_and_row, 2)), vint_and(tex_x, vint_set1(3)));
+
+    vfloat_store(&row->depths[lane], vfloat_blend(old_depth, depth, mask));
+    vint_t old_color = vint_load(&row->colors[lane]);
+    vint_store(&row->colors[lane], vint_gather(old_color, setup->level.texels, index, mask));
+}
+#endif
+
+// shading the lanes [first_lane, last_lane] of a block row; full batches go through the
+// SIMD path (power of two textures only), the rest one pixel at a time
+static void shade_textured_row(const textured_setup_t* setup, const raster_row_t* row, int first_lane, int last_lane) {
+#if RASTER_BATCH_SIZE > 1
+    if(setup->tile_row_shift >= 0){
+        for(int lane = 0; lane < RASTER_BLOCK_SIZE; lane += RASTER_BATCH_SIZE){
+            int batch_last = lane + RASTER_BATCH_SIZE - 1;
+            if(lane >= first_lane && batch_last <= last_lane){
+                shade_textured_batch(setup, row, lane);
+            } else if(batch_last >= first_lane && lane <= last_lane){
+                shade_textured_lanes(
+                    setup, row,
+                    (lane > first_lane) ? lane : first_lane,
+                    (batch_last < last_lane) ? batch_last : last_lane
+                );
             }
         }
+        return;
     }
+#endif
+    shade_textured_lanes(setup, row, first_lane, last_lane);
+}
 
-    inv_slope_1 = 0;
-    inv_slope_2 = 0;
+static int power_of_two_shift(int size) {
+    if(size <= 0 || (size & (size - 1)) != 0) return -1;
 
-    if(y2 - y1 != 0) inv_slope_1 = (float)(x2 - x1) / abs(y2 - y1);
-    if(y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
+    int shift = 0;
+    while((1 << shift) < size) ++shift;
+    return shift;
+}
 
-    if(y2 - y1 != 0){
-        for(int y = y1; y <= y2; ++y){
-            int x_start = x1 + (y - y1) * inv_slope_1;
-            int x_end = x0 + (y - y0) * inv_slope_2;
+// picking the mip level for a block from the uv derivatives at pixel (x, y): the level
+// whose texels come closest to one per pixel along the axis where the texture is the most
+// minified (the level of detail of OpenGL's NEAREST_MIPMAP_NEAREST)
+static int select_texture_level(const texture_t* texture, const raster_triangle_t* triangle, const float u_over_w[3], const float v_over_w[3], float u_over_w_dy, float v_over_w_dy, const textured_setup_t* setup, int x, int y) {
+    if(texture->num_levels <= 1) return 0;
+
+    float reciprocal_w = attribute_at(triangle, triangle->reciprocal_w0, triangle->reciprocal_w_dx, triangle->reciprocal_w_dy, x, y);
+    if(!(reciprocal_w > 0)) return 0;
+
+    // u = (u/w) / (1/w), so du/dx = (d(u/w)/dx - u * d(1/w)/dx) / (1/w), scaled to texels
+    float w = 1.0f / reciprocal_w;
+    float u = attribute_at(triangle, u_over_w[0], setup->u_over_w_dx, u_over_w_dy, x, y) * w;
+    float v = attribute_at(triangle, v_over_w[0], setup->v_over_w_dx, v_over_w_dy, x, y) * w;
+    float width = texture->levels[0].width;
+    float height = texture->levels[0].height;
+    float du_dx = (setup->u_over_w_dx - u * triangle->reciprocal_w_dx) * w * width;
+    float dv_dx = (setup->v_over_w_dx - v * triangle->reciprocal_w_dx) * w * height;
+    float du_dy = (u_over_w_dy - u * triangle->reciprocal_w_dy) * w * width;
+    float dv_dy = (v_over_w_dy - v * triangle->reciprocal_w_dy) * w * height;
+    float dx = du_dx * du_dx + dv_dx * dv_dx;
+    float dy = du_dy * du_dy + dv_dy * dv_dy;
+    float texels_per_pixel_squared = (dx > dy) ? dx : dy;
+
+    // level n is picked from sqrt(2) * 2^(n-1) texels per pixel on, rounding log2 to nearest
+    int level = 0;
+    float threshold = 2.0f;
+    while(level + 1 < texture->num_levels && texels_per_pixel_squared >= threshold){
+        ++level;
+        threshold *= 4.0f;
+    }
+    return level;
+}
 
-            if(x_end < x_start){
-                int_swap(&x_start, &x_end);
-            }
 
-            for(int x = x_start; x < x_end; ++x){
-                draw_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+void draw_textured_triangle(
+    float x0, float y0, float w0, float u0, float v0, 
+    float x1, float y1, float w1, float u1, float v1, 
+    float x2, float y2, float w2, float u2, float v2,
+    texture_t* texture
+){
+    if(texture->first_level >= texture->num_levels) return; // none of its levels could be loaded
+
+    float x[3] = { x0, x1, x2 };
+    float y[3] = { y0, y1, y2 };
+    float w[3] = { w0, w1, w2 };
+    raster_triangle_t triangle;
+    if(!setup_raster_triangle(x, y, w, &triangle)) return;
+
+    // 1/w, u/w and v/w are linear in screen space; they're interpolated instead of u and v
+    float u_over_w[3] = { u0 / w0, u1 / w1, u2 / w2 };
+    float v_over_w[3] = { (1.0 - v0) / w0, (1.0 - v1) / w1, (1.0 - v2) / w2 };
+
+    textured_setup_t setup;
+    float u_over_w_dy, v_over_w_dy;
+    setup.reciprocal_w_dx = triangle.reciprocal_w_dx;
+    attribute_gradients(&triangle, u_over_w, &setup.u_over_w_dx, &u_over_w_dy);
+    attribute_gradients(&triangle, v_over_w, &setup.v_over_w_dx, &v_over_w_dy);
+
+    rect_t clip = get_clip_rect();
+
+    for(int block_y = triangle.min_y & ~(RASTER_BLOCK_SIZE - 1); block_y <= triangle.max_y; block_y += RASTER_BLOCK_SIZE){
+        int first_y = (block_y > triangle.min_y) ? block_y : triangle.min_y;
+        int last_y = (block_y + RASTER_BLOCK_SIZE - 1 < triangle.max_y) ? block_y + RASTER_BLOCK_SIZE - 1 : triangle.max_y;
+
+        for(int block_x = triangle.min_x & ~(RASTER_BLOCK_SIZE - 1); block_x <= triangle.max_x; block_x += RASTER_BLOCK_SIZE){
+            // the whole block row is shaded (the edges reject what's outside the triangle),
+            // as long as it's inside the clip rect
+            int first_x = (block_x > clip.x0) ? block_x : clip.x0;
+            int last_x = (block_x + RASTER_BLOCK_SIZE - 1 < clip.x1 - 1) ? block_x + RASTER_BLOCK_SIZE - 1 : clip.x1 - 1;
+
+            if(!setup_raster_block(&triangle, block_x, first_x, last_x, first_y, last_y, &setup.block)) continue;
+
+            // every block samples a single mip level, picked at its center; the finest
+            // resident one when that one was evicted
+            int level = select_texture_level(
+                texture, &triangle, u_over_w, v_over_w, u_over_w_dy, v_over_w_dy, &setup,
+                (first_x + last_x) / 2, (first_y + last_y) / 2
+            );
+            mark_texture_level_used(texture, level);
+            if(level < texture->first_level) level = texture->first_level;
+            setup.level = texture->levels[level];
+            setup.tile_row_shift = power_of_two_shift(setup.level.tile_row_stride);
+            if(power_of_two_shift(setup.level.width) < 0 || power_of_two_shift(setup.level.height) < 0) setup.tile_row_shift = -1;
+
+            for(int y = first_y; y <= last_y; ++y){
+                raster_row_t row = {
+                    .colors = &color_buffer[(window_width * y) + block_x],
+                    .depths = &z_buffer[(window_width * y) + block_x],
+                    .e = { setup.block.row_e[0], setup.block.row_e[1], setup.block.row_e[2] },
+                    .reciprocal_w = attribute_at(&triangle, triangle.reciprocal_w0, triangle.reciprocal_w_dx, triangle.reciprocal_w_dy, block_x, y),
+                    .u_over_w = attribute_at(&triangle, u_over_w[0], setup.u_over_w_dx, u_over_w_dy, block_x, y),
+                    .v_over_w = attribute_at(&triangle, v_over_w[0], setup.v_over_w_dx, v_over_w_dy, block_x, y)
+                };
+                shade_textured_row(&setup, &row, first_x - block_x, last_x - block_x);
+
+                setup.block.row_e[0] += setup.block.e_dy[0];
+                setup.block.row_e[1] += setup.block.e_dy[1];
+                setup.block.row_e[2] += setup.block.e_dy[2];
             }
+            update_hiz(&triangle, &setup.block, block_x, block_y);
         }
     }
-}
\ No newline at end of file
+}
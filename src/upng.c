@@ -28,6 +28,7 @@ freely, subject to the following restrictions:
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 
 #include "headers/upng.h"
 
@@ -47,14 +48,12 @@ freely, subject to the following restrictions:
 #define NUM_CODE_LENGTH_CODES 19	/*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros */
 #define MAX_SYMBOLS 288 /* largest number of symbols used by any tree type */
 
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
 #define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
+#define HUFFMAN_FIRST_BITS 10	/* bits indexing the first level of a decoding table; longer codes continue in a subtable */
+#define HUFFMAN_TABLE_SIZE 2560	/* the first level and the largest subtables a complete code of 288 symbols can need (48 of 32 entries) */
+#define HUFFMAN_LINK 0x100000	/* a table entry pointing to a subtable */
 
 #define SET_ERROR(upng,code) do { (upng)->error = (code); (upng)->error_line = __LINE__; } while (0)
 
@@ -100,11 +99,22 @@ struct upng_t {
 	upng_source		source;
 };
 
-typedef struct huffman_tree {
-	unsigned* tree2d;
-	unsigned maxbitlen;	/*maximum number of bits a single code can get */
-	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
-} huffman_tree;
+/* a deflate stream is read through a 64 bit buffer, topped up a whole word at a time; the next bit is its lsb */
+typedef struct bit_reader {
+	const unsigned char*	in;
+	unsigned long			size;	/* bytes in the stream */
+	unsigned long			next;	/* next byte to shift into the buffer */
+	uint64_t				buffer;	/* bits not read yet */
+	unsigned				count;	/* number of valid bits in the buffer */
+} bit_reader;
+
+/* a huffman code decoded by table lookup: the first first_bits of a code (lsb first, as they come out of the
+ * stream) index the first level table, whose entries hold either the symbol and code length, or, for longer
+ * codes, where their subtable starts and how many more bits index it. entries with a length of 0 are invalid */
+typedef struct huffman_table {
+	uint32_t	entries[HUFFMAN_TABLE_SIZE];
+	unsigned	first_bits;
+} huffman_table;
 
 static const unsigned LENGTH_BASE[29] = {	/*the base lengths represented by codes 257-285 */
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
@@ -129,204 +139,209 @@ static const unsigned DISTANCE_EXTRA[30] = {	/*the extra bits of backwards dista
 static const unsigned CLCL[NUM_CODE_LENGTH_CODES]	/*the order in which "code length alphabet code lengths" are stored, out of this the huffman tree of the dynamic huffman tree lengths is generated */
 = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-	289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-	2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-	13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-	19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-	28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-	37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-	340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-	54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-	363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-	367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-	403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-	85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-	389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-	397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-	419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-	118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-	127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-	134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-	143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-	146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-	155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-	160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-	169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-	176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-	185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-	487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-	497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-	502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-	512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-	517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-	231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-	532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-	247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-	547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-	263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-	562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-	572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
+/* top the buffer up to at least 56 bits, enough for a length and a distance with their extra bits. past the end of
+ * the stream it's filled with zeros; bit_reader_overrun() tells when those got read */
+static void bit_reader_refill(bit_reader* reader)
+{
+	if (reader->next + 8 <= reader->size) {
+		const unsigned char* p = reader->in + reader->next;
+		uint64_t word = (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+			((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+
+		/* the bytes that only partly fit are loaded again next time */
+		reader->buffer |= word << reader->count;
+		reader->next += (63 - reader->count) >> 3;
+		reader->count |= 56;
+	} else {
+		while (reader->count < 56) {
+			if (reader->next < reader->size) {
+				reader->buffer |= (uint64_t)reader->in[reader->next] << reader->count;
+			}
+			reader->next++;
+			reader->count += 8;
+		}
+	}
+}
 
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-	33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-	44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-	18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-	29, 30, 31, 0, 0
-};
+static int bit_reader_overrun(const bit_reader* reader)
+{
+	return reader->next > reader->size && reader->next * 8 - reader->count > reader->size * 8;
+}
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+/* nbits must be in the buffer already */
+static unsigned bit_reader_read(bit_reader* reader, unsigned nbits)
 {
-	unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
+	unsigned result = (unsigned)(reader->buffer & (((uint64_t)1 << nbits) - 1));
+	reader->buffer >>= nbits;
+	reader->count -= nbits;
 	return result;
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream, unsigned long nbits)
+static unsigned reverse_bits(unsigned code, unsigned nbits)
 {
 	unsigned result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
+	for (i = 0; i < nbits; i++) {
+		result = (result << 1) | ((code >> i) & 1);
+	}
 	return result;
 }
 
-/* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
+/*given the code lengths (as stored in the PNG file), generate the decoding table of the canonical code they describe, as defined by Deflate*/
+static void huffman_table_create_lengths(upng_t* upng, huffman_table* table, const unsigned* bitlen, unsigned numcodes, unsigned first_bits)
 {
-	tree->tree2d = buffer;
+	unsigned codes[MAX_SYMBOLS];
+	unsigned blcount[MAX_BIT_LENGTH + 1];
+	unsigned nextcode[MAX_BIT_LENGTH + 1];
+	unsigned char subtable_bits[1 << HUFFMAN_FIRST_BITS];	/* bits indexing the subtable of each first level entry */
+	unsigned first_size = 1u << first_bits;
+	unsigned bits, n, i, used, numused = 0;
+	long left = 1;
 
-	tree->numcodes = numcodes;
-	tree->maxbitlen = maxbitlen;
-}
-
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
-static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned *bitlen)
-{
-	unsigned tree1d[MAX_SYMBOLS];
-	unsigned blcount[MAX_BIT_LENGTH];
-	unsigned nextcode[MAX_BIT_LENGTH+1];
-	unsigned bits, n, i;
-	unsigned nodefilled = 0;	/*up to which node it is filled */
-	unsigned treepos = 0;	/*position in the tree (1 of the numcodes columns) */
-
-	/* initialize local vectors */
+	/*step 1: count number of instances of each code length */
 	memset(blcount, 0, sizeof(blcount));
-	memset(nextcode, 0, sizeof(nextcode));
+	for (n = 0; n < numcodes; n++) {
+		blcount[bitlen[n]]++;
+	}
+	blcount[0] = 0;
 
-	/*step 1: count number of instances of each code length */
-	for (bits = 0; bits < tree->numcodes; bits++) {
-		blcount[bitlen[bits]]++;
+	/* a code has to be complete: a set of codes with room for more is only allowed with at most one code in it
+	 * (a block with a single distance, or none), and one with more codes than fit is never valid */
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+		left = (left << 1) - (long)blcount[bits];
+		if (left < 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+		numused += blcount[bits];
+	}
+	if (left > 0 && numused > 1) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
 	}
 
 	/*step 2: generate the nextcode values */
-	for (bits = 1; bits <= tree->maxbitlen; bits++) {
+	nextcode[0] = 0;
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
 		nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
 	}
 
-	/*step 3: generate all the codes */
-	for (n = 0; n < tree->numcodes; n++) {
+	/*step 3: generate all the codes, bit reversed since the stream delivers them from their msb */
+	for (n = 0; n < numcodes; n++) {
 		if (bitlen[n] != 0) {
-			tree1d[n] = nextcode[bitlen[n]]++;
+			codes[n] = reverse_bits(nextcode[bitlen[n]]++, bitlen[n]);
 		}
 	}
 
-	/*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means uninited, a value >= numcodes is an address to another bit, a value < numcodes is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as many columns as codes - 1
-	   a good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes. Here, the internal nodes are stored (what their 0 and 1 option point to). There is only memory for such good tree currently, if there are more nodes (due to too long length codes), error 55 will happen */
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		tree->tree2d[n] = 32767;	/*32767 here means the tree2d isn't filled there yet */
+	/* step 4: size the subtables after the longest code each one has to hold, and lay them out after the first level */
+	table->first_bits = first_bits;
+	memset(table->entries, 0, first_size * sizeof(table->entries[0]));
+	memset(subtable_bits, 0, first_size);
+	for (n = 0; n < numcodes; n++) {
+		if (bitlen[n] > first_bits) {
+			unsigned char* sub = &subtable_bits[codes[n] & (first_size - 1)];
+			if (bitlen[n] - first_bits > *sub) {
+				*sub = (unsigned char)(bitlen[n] - first_bits);
+			}
+		}
 	}
 
-	for (n = 0; n < tree->numcodes; n++) {	/*the codes */
-		for (i = 0; i < bitlen[n]; i++) {	/*the bits for this code */
-			unsigned char bit = (unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-			/* check if oversubscribed */
-			if (treepos > tree->numcodes - 2) {
+	used = first_size;
+	for (i = 0; i < first_size; i++) {
+		if (subtable_bits[i] != 0) {
+			unsigned size = 1u << subtable_bits[i];
+			if (used + size > HUFFMAN_TABLE_SIZE) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			if (tree->tree2d[2 * treepos + bit] == 32767) {	/*not yet filled in */
-				if (i + 1 == bitlen[n]) {	/*last bit */
-					tree->tree2d[2 * treepos + bit] = n;	/*put the current code in it */
-					treepos = 0;
-				} else {	/*put address of the next step in here, first that address has to be found of course (it's just nodefilled + 1)... */
-					nodefilled++;
-					tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;	/*addresses encoded with numcodes added to it */
-					treepos = nodefilled;
-				}
-			} else {
-				treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
-			}
+			table->entries[i] = HUFFMAN_LINK | ((uint32_t)subtable_bits[i] << 16) | used;
+			memset(&table->entries[used], 0, size * sizeof(table->entries[0]));
+			used += size;
 		}
 	}
 
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		if (tree->tree2d[n] == 32767) {
-			tree->tree2d[n] = 0;	/*remove possible remaining 32767's */
+	/* step 5: fill in every entry whose index starts with a code */
+	for (n = 0; n < numcodes; n++) {
+		uint32_t entry = ((uint32_t)bitlen[n] << 16) | n;
+
+		if (bitlen[n] == 0) {
+			continue;
+		}
+
+		if (bitlen[n] <= first_bits) {
+			for (i = codes[n]; i < first_size; i += 1u << bitlen[n]) {
+				table->entries[i] = entry;
+			}
+		} else {
+			uint32_t link = table->entries[codes[n] & (first_size - 1)];
+			unsigned start = link & 0xFFFF, size = 1u << ((link >> 16) & 15);
+
+			for (i = codes[n] >> first_bits; i < size; i += 1u << (bitlen[n] - first_bits)) {
+				table->entries[start + i] = entry;
+			}
 		}
 	}
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+/* the longest code (15 bits) must be in the buffer already */
+static unsigned huffman_decode_symbol(upng_t *upng, bit_reader* reader, const huffman_table* table)
 {
-	unsigned treepos = 0, ct;
-	unsigned char bit;
-	for (;;) {
-		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
-
-		bit = read_bit(bp, in);
+	uint32_t entry = table->entries[reader->buffer & ((1u << table->first_bits) - 1)];
+	unsigned length;
 
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
-		}
+	if (entry & HUFFMAN_LINK) {
+		unsigned subtable_mask = (1u << ((entry >> 16) & 15)) - 1;
+		entry = table->entries[(entry & 0xFFFF) + ((unsigned)(reader->buffer >> table->first_bits) & subtable_mask)];
+	}
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	/* error: a code the tree doesn't have */
+	length = (entry >> 16) & 15;
+	if (length == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
 	}
+
+	reader->buffer >>= length;
+	reader->count -= length;
+	return entry & 0xFFFF;
 }
 
-/* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+/* get the tables of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_table* codetree, huffman_table* codetreeD, bit_reader* reader)
 {
+	huffman_table codelengthcodetree;
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
 	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
 	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
 	unsigned n, hlit, hdist, hclen, i;
 
-	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
-	/*C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
-
 	/* clear bitlen arrays */
 	memset(bitlen, 0, sizeof(bitlen));
 	memset(bitlenD, 0, sizeof(bitlenD));
 
-	/*the bit pointer is or will go past the memory */
-	hlit = read_bits(bp, in, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
+	bit_reader_refill(reader);
+	hlit = bit_reader_read(reader, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
+	hdist = bit_reader_read(reader, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
+	hclen = bit_reader_read(reader, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
 
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+			if (reader->count < 3) {
+				bit_reader_refill(reader);
+			}
+			codelengthcode[CLCL[i]] = bit_reader_read(reader, 3);
 		} else {
 			codelengthcode[CLCL[i]] = 0;	/*if not, it must stay 0 */
 		}
 	}
 
-	huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
+	/* error: the bit pointer went past the memory */
+	if (bit_reader_overrun(reader)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	huffman_table_create_lengths(upng, &codelengthcodetree, codelengthcode, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
 
 	/* bail now if we encountered an error earlier */
 	if (upng->error != UPNG_EOK) {
@@ -336,7 +351,11 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	/*now we can use this tree to read the lengths for the tree that this function will return */
 	i = 0;
 	while (i < hlit + hdist) {	/*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-		unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+		unsigned code, replength, value;
+
+		/* a code length code and its repeat count take up to 14 bits */
+		bit_reader_refill(reader);
+		code = huffman_decode_symbol(upng, reader, &codelengthcodetree);
 		if (upng->error != UPNG_EOK) {
 			break;
 		}
@@ -348,142 +367,126 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 				bitlenD[i - hlit] = code;
 			}
 			i++;
-		} else if (code == 16) {	/*repeat previous */
-			unsigned replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
-			unsigned value;	/*set value to the previous code */
+			continue;
+		}
 
-			if ((*bp) >> 3 >= inlength) {
+		if (code == 16) {	/*repeat previous 3-6 times */
+			/* error: there is no previous length */
+			if (i == 0) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
 
-			if ((i - 1) < hlit) {
-				value = bitlen[i - 1];
-			} else {
-				value = bitlenD[i - hlit - 1];
-			}
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = value;
-				} else {
-					bitlenD[i - hlit] = value;
-				}
-				i++;
-			}
+			replength = 3 + bit_reader_read(reader, 2);
+			value = (i - 1) < hlit ? bitlen[i - 1] : bitlenD[i - hlit - 1];
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
-			unsigned replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* error: i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = 0;
-				} else {
-					bitlenD[i - hlit] = 0;
-				}
-				i++;
-			}
-		} else if (code == 18) {	/*repeat "0" 11-138 times */
-			unsigned replength = 11;	/*read in the bits that indicate repeat length */
-			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
+			replength = 3 + bit_reader_read(reader, 3);
+			value = 0;
+		} else {	/*18: repeat "0" 11-138 times */
+			replength = 11 + bit_reader_read(reader, 7);
+			value = 0;
+		}
 
-			replength += read_bits(bp, in, 7);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-				if (i < hlit)
-					bitlen[i] = 0;
-				else
-					bitlenD[i - hlit] = 0;
-				i++;
-			}
-		} else {
-			/* somehow an unexisting code appeared. This can never happen. */
+		/* error: i would be larger than the amount of codes */
+		if (replength > hlit + hdist - i) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			break;
 		}
+
+		/*repeat this value in the next lengths */
+		for (n = 0; n < replength; n++) {
+			if (i < hlit) {
+				bitlen[i] = value;
+			} else {
+				bitlenD[i - hlit] = value;
+			}
+			i++;
+		}
 	}
 
-	if (upng->error == UPNG_EOK && bitlen[256] == 0) {
+	if (upng->error == UPNG_EOK && bit_reader_overrun(reader)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 	}
 
 	/*the length of the end code 256 must be larger than 0 */
-	/*now we've finally got hlit and hdist, so generate the code trees, and the function is done */
+	if (upng->error == UPNG_EOK && bitlen[256] == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
+
+	/*now we've finally got hlit and hdist, so generate the code tables, and the function is done */
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetree, bitlen);
+		huffman_table_create_lengths(upng, codetree, bitlen, NUM_DEFLATE_CODE_SYMBOLS, HUFFMAN_FIRST_BITS);
 	}
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+		huffman_table_create_lengths(upng, codetreeD, bitlenD, NUM_DISTANCE_SYMBOLS, HUFFMAN_FIRST_BITS);
 	}
 }
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+/* the tables of the fixed Huffman codes of btype 1 */
+static void get_tree_inflate_fixed(upng_t* upng, huffman_table* codetree, huffman_table* codetreeD)
 {
-	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
-	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
-	unsigned done = 0;
+	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+	unsigned n;
+
+	for (n = 0; n < NUM_DEFLATE_CODE_SYMBOLS; n++) {
+		bitlen[n] = n < 144 ? 8 : n < 256 ? 9 : n < 280 ? 7 : 8;
+	}
+	for (n = 0; n < NUM_DISTANCE_SYMBOLS; n++) {
+		bitlenD[n] = 5;
+	}
+
+	huffman_table_create_lengths(upng, codetree, bitlen, NUM_DEFLATE_CODE_SYMBOLS, HUFFMAN_FIRST_BITS);
+	huffman_table_create_lengths(upng, codetreeD, bitlenD, NUM_DISTANCE_SYMBOLS, HUFFMAN_FIRST_BITS);
+}
+
+/* copy length bytes from distance bytes back. 8 bytes at a time when they don't overlap, which may write up to
+ * 7 bytes past the end of the match (they get overwritten by what comes next), as long as there is room for them */
+static void copy_match(unsigned char* out, unsigned long distance, unsigned long length, unsigned long room)
+{
+	const unsigned char* from = out - distance;
+	unsigned long n;
+
+	if (distance >= 8 && ((length + 7) & ~7UL) <= room) {
+		for (n = 0; n < length; n += 8) {
+			memcpy(out + n, from + n, 8);
+		}
+	} else if (distance == 1) {
+		memset(out, from[0], length);
+	} else {
+		for (n = 0; n < length; n++) {
+			out[n] = from[n];
+		}
+	}
+}
 
-	huffman_tree codetree;
-	huffman_tree codetreeD;
+/*inflate a block with dynamic of fixed Huffman tree*/
+static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, bit_reader* reader, unsigned long *pos, unsigned btype)
+{
+	huffman_table codetree;
+	huffman_table codetreeD;
 
 	if (btype == 1) {
-		/* fixed trees */
-		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-	} else if (btype == 2) {
-		/* dynamic trees */
-		unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
-		huffman_tree codelengthcodetree;
+		get_tree_inflate_fixed(upng, &codetree, &codetreeD);
+	} else {
+		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, reader);
+	}
 
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+	if (upng->error != UPNG_EOK) {
+		return;
 	}
 
-	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+	for (;;) {
+		unsigned code;
+
+		/* a length code, its extra bits, a distance code and its extra bits take up to 48 bits */
+		bit_reader_refill(reader);
+		code = huffman_decode_symbol(upng, reader, &codetree);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
 
-		if (code == 256) {
-			/* end code */
-			done = 1;
-		} else if (code <= 255) {
+		if (code <= 255) {
 			/* literal symbol */
 			if ((*pos) >= outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
@@ -493,23 +496,14 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			/* store output */
 			out[(*pos)++] = (unsigned char)(code);
 		} else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
-			/* part 1: get length base */
-			unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
-			unsigned codeD, distance, numextrabitsD;
-			unsigned long start, forward, backward, numextrabits;
+			unsigned long length, distance;
+			unsigned codeD;
 
-			/* part 2: get extra bits and add the value of that to length */
-			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
+			/* get length base and the extra bits to add to it */
+			length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX] + bit_reader_read(reader, LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX]);
 
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-			length += read_bits(bp, in, numextrabits);
-
-			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			/* get distance code */
+			codeD = huffman_decode_symbol(upng, reader, &codetreeD);
 			if (upng->error != UPNG_EOK) {
 				return;
 			}
@@ -520,60 +514,56 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 				return;
 			}
 
-			distance = DISTANCE_BASE[codeD];
-
-			/*part 4: get extra bits from distance */
-			numextrabitsD = DISTANCE_EXTRA[codeD];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-
-			distance += read_bits(bp, in, numextrabitsD);
-
-			/*part 5: fill in all the out[n] values based on the length and dist */
-			start = (*pos);
-			backward = start - distance;
+			distance = DISTANCE_BASE[codeD] + bit_reader_read(reader, DISTANCE_EXTRA[codeD]);
 
-			if ((*pos) + length >= outsize) {
+			/* error: the match starts before the output or ends after it */
+			if (distance > (*pos) || length > outsize - (*pos)) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			for (forward = 0; forward < length; forward++) {
-				out[(*pos)++] = out[backward];
-				backward++;
+			copy_match(out + (*pos), distance, length, outsize - (*pos));
+			(*pos) += length;
+		} else if (code == 256) {
+			/* end code */
+			break;
+		} else {
+			/* codes 286-287 are never used */
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
 
-				if (backward >= start) {
-					backward = start - distance;
-				}
-			}
+		/* error: end of input memory reached without endcode */
+		if (bit_reader_overrun(reader)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
 		}
 	}
+
+	if (bit_reader_overrun(reader)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, bit_reader* reader, unsigned long *pos)
 {
 	unsigned long p;
-	unsigned len, nlen, n;
+	unsigned len, nlen;
 
-	/* go to first boundary of byte */
-	while (((*bp) & 0x7) != 0) {
-		(*bp)++;
-	}
-	p = (*bp) / 8;		/*byte position */
+	/* go to first boundary of byte, and hand the whole bytes left in the buffer back to the input */
+	p = reader->next - reader->count / 8;	/*byte position */
+	reader->buffer = 0;
+	reader->count = 0;
 
 	/* read len (2 bytes) and nlen (2 bytes) */
-	if (p >= inlength - 4) {
+	if (p + 4 > reader->size) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	len = in[p] + 256 * in[p + 1];
+	len = reader->in[p] + 256 * reader->in[p + 1];
 	p += 2;
-	nlen = in[p] + 256 * in[p + 1];
+	nlen = reader->in[p] + 256 * reader->in[p + 1];
 	p += 2;
 
 	/* check if 16-bit nlen is really the one's complement of len */
@@ -582,53 +572,58 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 		return;
 	}
 
-	if ((*pos) + len >= outsize) {
+	if (len > outsize - (*pos)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
 	/* read the literal data: len bytes are now stored in the out buffer */
-	if (p + len > inlength) {
+	if (len > reader->size - p) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
-	}
-
-	(*bp) = p * 8;
+	memcpy(out + (*pos), reader->in + p, len);
+	(*pos) += len;
+	reader->next = p + len;
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
 static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
+	bit_reader reader;
 	unsigned long pos = 0;	/*byte position in the out buffer */
 
 	unsigned done = 0;
 
+	reader.in = in + inpos;
+	reader.size = insize - inpos;
+	reader.next = 0;
+	reader.buffer = 0;
+	reader.count = 0;
+
 	while (done == 0) {
 		unsigned btype;
 
-		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		/* read block control bits */
+		bit_reader_refill(&reader);
+		done = bit_reader_read(&reader, 1);
+		btype = bit_reader_read(&reader, 2);
+
+		/* ensure they didn't point past the end of the buffer */
+		if (bit_reader_overrun(&reader)) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 
-		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
-
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, out, outsize, &reader, &pos);	/*no compression */
 		} else {
-			inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	/*compression, btype 01 or 10 */
+			inflate_huffman(upng, out, outsize, &reader, &pos, btype);	/*compression, btype 01 or 10 */
 		}
 
 		/* stop if an error has occured */
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <stdlib.h>
 #include "headers/vector.h"
 
 // VECTOR 2D functions
@@ -149,4 +150,28 @@ vec3_t vec3_from_vec4(vec4_t v) {
 vec2_t vec2_from_vec4(vec4_t v) {
     vec2_t result = { v.x, v.y };
     return result;
+}
+
+// VECTOR SoA functions
+vec3_soa_t vec3_soa_from_array(vec3_t* vectors, int count) {
+    vec3_soa_t soa = {
+        .x = (float*)malloc(sizeof(float) * count),
+        .y = (float*)malloc(sizeof(float) * count),
+        .z = (float*)malloc(sizeof(float) * count)
+    };
+    for(int i = 0; i < count; ++i) {
+        soa.x[i] = vectors[i].x;
+        soa.y[i] = vectors[i].y;
+        soa.z[i] = vectors[i].z;
+    }
+    return soa;
+}
+
+void vec3_soa_free(vec3_soa_t* soa) {
+    free(soa->x);
+    free(soa->y);
+    free(soa->z);
+    soa->x = NULL;
+    soa->y = NULL;
+    soa->z = NULL;
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "headers/vertex.h"
+#include "headers/display.h"
+
+// the SoA vertex kernel works on VERTEX_BATCH_SIZE vertices at a time, using the widest
+// instruction set the compiler targets (e.g. build with -mavx2 or -march=native for AVX2)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VERTEX_BATCH_SIZE 8
+typedef __m256 vfloat_t;
+#define vfloat_set1 _mm256_set1_ps
+#define vfloat_load _mm256_loadu_ps
+#define vfloat_add _mm256_add_ps
+#define vfloat_sub _mm256_sub_ps
+#define vfloat_mul _mm256_mul_ps
+#define vfloat_div _mm256_div_ps
+#define vfloat_blend_nonzero(value, if_nonzero, if_zero) \
+    _mm256_blendv_ps((if_zero), (if_nonzero), _mm256_cmp_ps((value), _mm256_setzero_ps(), _CMP_NEQ_OQ))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VERTEX_BATCH_SIZE 4
+typedef __m128 vfloat_t;
+#define vfloat_set1 _mm_set1_ps
+#define vfloat_load _mm_loadu_ps
+#define vfloat_add _mm_add_ps
+#define vfloat_sub _mm_sub_ps
+#define vfloat_mul _mm_mul_ps
+#define vfloat_div _mm_div_ps
+#define vfloat_blend_nonzero(value, if_nonzero, if_zero) \
+    _mm_or_ps( \
+        _mm_and_ps(_mm_cmpneq_ps((value), _mm_setzero_ps()), (if_nonzero)), \
+        _mm_andnot_ps(_mm_cmpneq_ps((value), _mm_setzero_ps()), (if_zero)) \
+    )
+#else
+#define VERTEX_BATCH_SIZE 1
+#endif
+
+// creating a world matrix combining scale, rotation, and translation matrices.
+mat4_t make_world_matrix(vec3_t scale, vec3_t rotation, vec3_t translation) {
+    mat4_t scale_matrix = mat4_make_scale(scale.x, scale.y, scale.z);
+    mat4_t translation_matrix = mat4_make_translation(translation.x, translation.y, translation.z);
+    mat4_t rotation_matrix_x = mat4_make_rotation_x(rotation.x);
+    mat4_t rotation_matrix_y = mat4_make_rotation_y(rotation.y);
+    mat4_t rotation_matrix_z = mat4_make_rotation_z(rotation.z);
+
+    mat4_t world_matrix = mat4_identity();
+
+    //////// ORDER of transformation /////////
+    // first SCALE
+    // then ROTATE
+    // lastly TRANSLATE
+
+    world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
+
+    world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
+
+    world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+
+    return world_matrix;
+}
+
+static transformed_vertex_t transform_vertex(vec3_t vertex, mat4_t* world_matrix, mat4_t* projection_matrix) {
+    float half_width = window_width / 2.0;
+    float half_height = window_height / 2.0;
+
+    vec4_t world = mat4_mul_vec4(*world_matrix, vec4_from_vec3(vertex));
+    vec4_t screen = mat4_mul_vec4_project(*projection_matrix, world);
+
+    // scaling into the view
+    screen.x *= half_width;
+    screen.y *= half_height;
+
+    // inverting the Y values to account for flipped screen Y coordinate
+    screen.y *= -1;
+
+    // translating the projected point to the middle of the screen
+    screen.x += half_width;
+    screen.y += half_height;
+
+    transformed_vertex_t transformed_vertex = { world, screen };
+    return transformed_vertex;
+}
+
+// transforming and projecting every vertex of a mesh exactly once;
+// faces then only gather the results by index, however many faces share a vertex
+void transform_vertices(
+    vec3_t* vertices, int num_vertices,
+    mat4_t world_matrix, mat4_t projection_matrix,
+    transformed_vertex_t* transformed_vertices
+) {
+    for(int i = 0; i < num_vertices; ++i) {
+        transformed_vertices[i] = transform_vertex(vertices[i], &world_matrix, &projection_matrix);
+    }
+}
+
+#if VERTEX_BATCH_SIZE > 1
+// row `row` of `m` times the column vector (x, y, z, w), with the same order of operations
+// as mat4_mul_vec4(), so the batched results are bit-identical to the scalar ones
+static inline vfloat_t mul_row(mat4_t* m, int row, vfloat_t x, vfloat_t y, vfloat_t z, vfloat_t w) {
+    vfloat_t result = vfloat_mul(vfloat_set1(m->m[row][0]), x);
+    result = vfloat_add(result, vfloat_mul(vfloat_set1(m->m[row][1]), y));
+    result = vfloat_add(result, vfloat_mul(vfloat_set1(m->m[row][2]), z));
+    result = vfloat_add(result, vfloat_mul(vfloat_set1(m->m[row][3]), w));
+    return result;
+}
+
+// transposing 4 lanes of (x, y, z, w) component vectors into 4 vec4_t and storing them
+static inline void store_vec4x4(__m128 x, __m128 y, __m128 z, __m128 w, transformed_vertex_t* out, int is_screen) {
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(is_screen ? &out[0].screen.x : &out[0].world.x, x);
+    _mm_storeu_ps(is_screen ? &out[1].screen.x : &out[1].world.x, y);
+    _mm_storeu_ps(is_screen ? &out[2].screen.x : &out[2].world.x, z);
+    _mm_storeu_ps(is_screen ? &out[3].screen.x : &out[3].world.x, w);
+}
+#endif
+
+// same as transform_vertices(), but reading SoA positions and running VERTEX_BATCH_SIZE
+// vertices per iteration: world transform, projection, perspective divide and viewport
+// mapping all happen in one pass over the batch
+void transform_vertices_soa(
+    vec3_soa_t* positions, int num_vertices,
+    mat4_t world_matrix, mat4_t projection_matrix,
+    transformed_vertex_t* transformed_vertices
+) {
+    int i = 0;
+
+#if VERTEX_BATCH_SIZE > 1
+    vfloat_t half_width = vfloat_set1(window_width / 2.0);
+    vfloat_t half_height = vfloat_set1(window_height / 2.0);
+    vfloat_t one = vfloat_set1(1.0);
+
+    for(; i + VERTEX_BATCH_SIZE <= num_vertices; i += VERTEX_BATCH_SIZE) {
+        vfloat_t x = vfloat_load(&positions->x[i]);
+        vfloat_t y = vfloat_load(&positions->y[i]);
+        vfloat_t z = vfloat_load(&positions->z[i]);
+
+        vfloat_t world_x = mul_row(&world_matrix, 0, x, y, z, one);
+        vfloat_t world_y = mul_row(&world_matrix, 1, x, y, z, one);
+        vfloat_t world_z = mul_row(&world_matrix, 2, x, y, z, one);
+        vfloat_t world_w = mul_row(&world_matrix, 3, x, y, z, one);
+
+        vfloat_t screen_x = mul_row(&projection_matrix, 0, world_x, world_y, world_z, world_w);
+        vfloat_t screen_y = mul_row(&projection_matrix, 1, world_x, world_y, world_z, world_w);
+        vfloat_t screen_z = mul_row(&projection_matrix, 2, world_x, world_y, world_z, world_w);
+        vfloat_t screen_w = mul_row(&projection_matrix, 3, world_x, world_y, world_z, world_w);
+
+        // perspective divide, skipped (per lane) where w is 0 like mat4_mul_vec4_project()
+        screen_x = vfloat_blend_nonzero(screen_w, vfloat_div(screen_x, screen_w), screen_x);
+        screen_y = vfloat_blend_nonzero(screen_w, vfloat_div(screen_y, screen_w), screen_y);
+        screen_z = vfloat_blend_nonzero(screen_w, vfloat_div(screen_z, screen_w), screen_z);
+
+        // viewport: scaling into the view, flipping Y and moving to the middle of the screen
+        screen_x = vfloat_add(vfloat_mul(screen_x, half_width), half_width);
+        screen_y = vfloat_sub(half_height, vfloat_mul(screen_y, half_height));
+
+        transformed_vertex_t* out = &transformed_vertices[i];
+#if VERTEX_BATCH_SIZE == 8
+        store_vec4x4(_mm256_castps256_ps128(world_x), _mm256_castps256_ps128(world_y), _mm256_castps256_ps128(world_z), _mm256_castps256_ps128(world_w), out, 0);
+        store_vec4x4(_mm256_extractf128_ps(world_x, 1), _mm256_extractf128_ps(world_y, 1), _mm256_extractf128_ps(world_z, 1), _mm256_extractf128_ps(world_w, 1), out + 4, 0);
+        store_vec4x4(_mm256_castps256_ps128(screen_x), _mm256_castps256_ps128(screen_y), _mm256_castps256_ps128(screen_z), _mm256_castps256_ps128(screen_w), out, 1);
+        store_vec4x4(_mm256_extractf128_ps(screen_x, 1), _mm256_extractf128_ps(screen_y, 1), _mm256_extractf128_ps(screen_z, 1), _mm256_extractf128_ps(screen_w, 1), out + 4, 1);
+#else
+        store_vec4x4(world_x, world_y, world_z, world_w, out, 0);
+        store_vec4x4(screen_x, screen_y, screen_z, screen_w, out, 1);
+#endif
+    }
+#endif
+
+    // the remaining vertices that don't fill a whole batch
+    for(; i < num_vertices; ++i) {
+        vec3_t vertex = { positions->x[i], positions->y[i], positions->z[i] };
+        transformed_vertices[i] = transform_vertex(vertex, &world_matrix, &projection_matrix);
+    }
+}
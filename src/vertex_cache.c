@@ -0,0 +1,182 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headers/vertex_cache.h"
+
+float vertex_cache_miss_ratio(face_t* faces, int num_faces, int first_vertex, int num_vertices) {
+    if(num_faces == 0) return 0;
+
+    // a vertex is in the FIFO when fewer than VERTEX_CACHE_SIZE misses came after its own
+    int* miss_time = (int*)malloc(sizeof(int) * num_vertices);
+    for(int v = 0; v < num_vertices; ++v){
+        miss_time[v] = -VERTEX_CACHE_SIZE - 1;
+    }
+
+    int num_misses = 0;
+    for(int i = 0; i < num_faces; ++i){
+        int corners[3] = { faces[i].a, faces[i].b, faces[i].c };
+        for(int k = 0; k < 3; ++k){
+            int v = corners[k] - first_vertex;
+            if(num_misses - miss_time[v] > VERTEX_CACHE_SIZE){
+                miss_time[v] = num_misses++;
+            }
+        }
+    }
+
+    free(miss_time);
+    return (float)num_misses / num_faces;
+}
+
+// the bookkeeping of optimize_face_order(); vertices are numbered from 0 here
+typedef struct {
+    int* live_faces;    // faces of each vertex not emitted yet
+    int* cache_time;    // when each vertex last entered the cache
+    int time;
+    int* dead_ends;     // stack of the corners of the emitted faces
+    int num_dead_ends;
+    int cursor;         // every vertex before it has no faces left
+    int num_vertices;
+} tipsify_t;
+
+// the vertex whose faces go next: of the corners of the faces just emitted, the one that's
+// been in the cache the longest but will still be in it after its remaining faces are
+// emitted; failing that, the latest corner with faces left, and failing that the next
+// vertex in order with faces left
+static int next_fan_vertex(tipsify_t* state, int* candidates, int num_candidates) {
+    int best = -1;
+    int best_priority = -1;
+    for(int i = 0; i < num_candidates; ++i){
+        int v = candidates[i];
+        if(state->live_faces[v] == 0) continue;
+
+        int age = state->time - state->cache_time[v];
+        int priority = (age + 2 * state->live_faces[v] <= VERTEX_CACHE_SIZE) ? age : 0;
+        if(priority > best_priority){
+            best_priority = priority;
+            best = v;
+        }
+    }
+    if(best != -1) return best;
+
+    while(state->num_dead_ends > 0){
+        int v = state->dead_ends[--state->num_dead_ends];
+        if(state->live_faces[v] > 0) return v;
+    }
+    for(; state->cursor < state->num_vertices; ++state->cursor){
+        if(state->live_faces[state->cursor] > 0) return state->cursor;
+    }
+    return -1;
+}
+
+// reordering the faces so the ones sharing vertices come close together, with Tipsify
+// (Sander, Nehab and Barczak, "Fast triangle reordering for vertex locality and reduced
+// overdraw", 2007): it emits every face around one vertex (a fan), then moves on to a
+// vertex of those faces that's still in the cache. linear in the number of faces
+void optimize_face_order(face_t* faces, int num_faces, int first_vertex, int num_vertices) {
+    if(num_faces == 0) return;
+
+    // the faces around each vertex: vertex_faces[vertex_face_offsets[v] ..] up to the next offset
+    int* vertex_face_offsets = (int*)calloc(num_vertices + 1, sizeof(int));
+    int* vertex_faces = (int*)malloc(sizeof(int) * num_faces * 3);
+    for(int i = 0; i < num_faces; ++i){
+        ++vertex_face_offsets[faces[i].a - first_vertex + 1];
+        ++vertex_face_offsets[faces[i].b - first_vertex + 1];
+        ++vertex_face_offsets[faces[i].c - first_vertex + 1];
+    }
+    for(int v = 0; v < num_vertices; ++v){
+        vertex_face_offsets[v + 1] += vertex_face_offsets[v];
+    }
+
+    tipsify_t state = {
+        .live_faces = (int*)malloc(sizeof(int) * num_vertices),
+        .cache_time = (int*)calloc(num_vertices, sizeof(int)),
+        .time = VERTEX_CACHE_SIZE + 1,
+        .dead_ends = (int*)malloc(sizeof(int) * num_faces * 3),
+        .num_dead_ends = 0,
+        .cursor = 0,
+        .num_vertices = num_vertices
+    };
+    for(int v = 0; v < num_vertices; ++v){
+        state.live_faces[v] = vertex_face_offsets[v + 1] - vertex_face_offsets[v];
+    }
+    int* fill = (int*)malloc(sizeof(int) * num_vertices);
+    memcpy(fill, vertex_face_offsets, sizeof(int) * num_vertices);
+    for(int i = 0; i < num_faces; ++i){
+        vertex_faces[fill[faces[i].a - first_vertex]++] = i;
+        vertex_faces[fill[faces[i].b - first_vertex]++] = i;
+        vertex_faces[fill[faces[i].c - first_vertex]++] = i;
+    }
+    free(fill);
+
+    bool* is_emitted = (bool*)calloc(num_faces, sizeof(bool));
+    face_t* new_faces = (face_t*)malloc(sizeof(face_t) * num_faces);
+    int* candidates = (int*)malloc(sizeof(int) * num_faces * 3);
+    int num_new_faces = 0;
+
+    int vertex = faces[0].a - first_vertex;
+    while(vertex != -1){
+        int num_candidates = 0;
+        for(int j = vertex_face_offsets[vertex]; j < vertex_face_offsets[vertex + 1]; ++j){
+            int f = vertex_faces[j];
+            if(is_emitted[f]) continue;
+            is_emitted[f] = true;
+            new_faces[num_new_faces++] = faces[f];
+
+            int corners[3] = { faces[f].a - first_vertex, faces[f].b - first_vertex, faces[f].c - first_vertex };
+            for(int k = 0; k < 3; ++k){
+                int v = corners[k];
+                state.dead_ends[state.num_dead_ends++] = v;
+                candidates[num_candidates++] = v;
+                --state.live_faces[v];
+                if(state.time - state.cache_time[v] > VERTEX_CACHE_SIZE) state.cache_time[v] = state.time++;
+            }
+        }
+        vertex = next_fan_vertex(&state, candidates, num_candidates);
+    }
+
+    memcpy(faces, new_faces, sizeof(face_t) * num_faces);
+
+    free(candidates);
+    free(new_faces);
+    free(is_emitted);
+    free(state.dead_ends);
+    free(state.cache_time);
+    free(state.live_faces);
+    free(vertex_faces);
+    free(vertex_face_offsets);
+}
+
+// renumbering the vertices in the order the faces first use them, so walking the faces
+// walks the vertices (nearly) front to back; vertices no face uses go last
+void optimize_vertex_order(face_t* faces, int num_faces, vec3_t* vertices, tex2_t* uvs, int first_vertex, int num_vertices) {
+    int* remap = (int*)malloc(sizeof(int) * num_vertices);
+    for(int v = 0; v < num_vertices; ++v){
+        remap[v] = -1;
+    }
+
+    int num_used = 0;
+    for(int i = 0; i < num_faces; ++i){
+        int* corners[3] = { &faces[i].a, &faces[i].b, &faces[i].c };
+        for(int k = 0; k < 3; ++k){
+            int v = *corners[k] - first_vertex;
+            if(remap[v] == -1) remap[v] = num_used++;
+            *corners[k] = first_vertex + remap[v];
+        }
+    }
+    for(int v = 0; v < num_vertices; ++v){
+        if(remap[v] == -1) remap[v] = num_used++;
+    }
+
+    vec3_t* old_vertices = (vec3_t*)malloc(sizeof(vec3_t) * num_vertices);
+    tex2_t* old_uvs = (tex2_t*)malloc(sizeof(tex2_t) * num_vertices);
+    memcpy(old_vertices, &vertices[first_vertex], sizeof(vec3_t) * num_vertices);
+    memcpy(old_uvs, &uvs[first_vertex], sizeof(tex2_t) * num_vertices);
+    for(int v = 0; v < num_vertices; ++v){
+        vertices[first_vertex + remap[v]] = old_vertices[v];
+        uvs[first_vertex + remap[v]] = old_uvs[v];
+    }
+
+    free(old_uvs);
+    free(old_vertices);
+    free(remap);
+}
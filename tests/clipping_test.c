@@ -0,0 +1,104 @@
+#include <math.h>
+#include <stdio.h>
+#include "../src/headers/clipping.h"
+
+#define WIDTH 800
+#define HEIGHT 600
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if(!(condition)){ \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while(0)
+
+// the screen position the vertex stage gives a view space point
+static vec4_t project(mat4_t* projection_matrix, vec4_t view) {
+    vec4_t clip = mat4_mul_vec4(*projection_matrix, view);
+    return (vec4_t){
+        (clip.x / clip.w) * (WIDTH / 2.0) + WIDTH / 2.0,
+        HEIGHT / 2.0 - (clip.y / clip.w) * (HEIGHT / 2.0),
+        clip.z / clip.w,
+        clip.w
+    };
+}
+
+// clipping a triangle the way the face stage does; returns the clipped polygon
+static polygon_t clip_triangle(mat4_t* projection_matrix, vec4_t a, vec4_t b, vec4_t c) {
+    vec4_t screen_a = project(projection_matrix, a);
+    vec4_t screen_b = project(projection_matrix, b);
+    vec4_t screen_c = project(projection_matrix, c);
+    int planes = (vertex_clip_flags(screen_a) | vertex_clip_flags(screen_b) | vertex_clip_flags(screen_c)) & CLIP_PLANES;
+
+    polygon_t polygon = polygon_from_triangle(
+        a, b, c, screen_a, screen_b, screen_c,
+        (tex2_t){ 0, 0 }, (tex2_t){ 1, 0 }, (tex2_t){ 0, 1 },
+        projection_matrix
+    );
+    clip_polygon(&polygon, planes);
+    return polygon;
+}
+
+static void check_polygon_in_guard_band(polygon_t* polygon) {
+    for(int i = 0; i < polygon->num_vertices; ++i){
+        vec4_t screen = polygon->vertices[i].screen;
+        CHECK(screen.w > 0);
+        CHECK(screen.z >= -1e-4f && screen.z <= 1 + 1e-4f);
+        CHECK(fabsf(screen.x) <= MAX_VERTEX_COORD && fabsf(screen.y) <= MAX_VERTEX_COORD);
+        CHECK(screen.x >= -GUARD_BAND_PIXELS - 1 && screen.x <= WIDTH + GUARD_BAND_PIXELS + 1);
+        CHECK(screen.y >= -GUARD_BAND_PIXELS - 1 && screen.y <= HEIGHT + GUARD_BAND_PIXELS + 1);
+    }
+}
+
+// one vertex behind the camera, the other two on screen: only CLIP_NEAR is set, and the
+// points cut on the near plane used to land far past the guard band
+static void test_triangle_crossing_camera_plane(mat4_t* projection_matrix) {
+    vec4_t a = { 0, 0, 2, 1 };
+    vec4_t b = { 40, 0, -1, 1 };
+    vec4_t c = { 0, 1, 2, 1 };
+    CHECK(vertex_clip_flags(project(projection_matrix, b)) == CLIP_NEAR);
+
+    polygon_t polygon = clip_triangle(projection_matrix, a, b, c);
+    CHECK(polygon.num_vertices >= 3);
+    check_polygon_in_guard_band(&polygon);
+}
+
+// a triangle entirely in front of the near plane and on screen is left as it is
+static void test_triangle_on_screen(mat4_t* projection_matrix) {
+    vec4_t a = { -1, -1, 5, 1 };
+    vec4_t b = { 1, -1, 5, 1 };
+    vec4_t c = { 0, 1, 5, 1 };
+
+    polygon_t polygon = clip_triangle(projection_matrix, a, b, c);
+    CHECK(polygon.num_vertices == 3);
+    check_polygon_in_guard_band(&polygon);
+}
+
+// a triangle entirely behind the camera clips to nothing
+static void test_triangle_behind_camera(mat4_t* projection_matrix) {
+    vec4_t a = { -1, -1, -5, 1 };
+    vec4_t b = { 1, -1, -5, 1 };
+    vec4_t c = { 0, 1, -5, 1 };
+
+    polygon_t polygon = clip_triangle(projection_matrix, a, b, c);
+    CHECK(polygon.num_vertices < 3);
+}
+
+int main(void) {
+    // the projection of main.c
+    mat4_t projection_matrix = mat4_make_perspective(3.141592 / 3.0, (float)HEIGHT / (float)WIDTH, 0.1, 100.0);
+    init_clipping(WIDTH, HEIGHT);
+
+    test_triangle_crossing_camera_plane(&projection_matrix);
+    test_triangle_on_screen(&projection_matrix);
+    test_triangle_behind_camera(&projection_matrix);
+
+    if(failures){
+        fprintf(stderr, "clipping_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("clipping_test: ok\n");
+    return 0;
+}